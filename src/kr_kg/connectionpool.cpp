@@ -0,0 +1,255 @@
+#include "connectionpool.h"
+#include <QMutexLocker>
+#include <QDebug>
+
+ConnectionPool::Guard::Guard(ConnectionPool* pool, std::unique_ptr<DatabaseManager> connection)
+    : pool(pool)
+    , connection(std::move(connection))
+{
+}
+
+ConnectionPool::Guard::Guard(Guard&& other) noexcept
+    : pool(other.pool)
+    , connection(std::move(other.connection))
+{
+    other.pool = nullptr;
+}
+
+ConnectionPool::Guard& ConnectionPool::Guard::operator=(Guard&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        connection = std::move(other.connection);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+ConnectionPool::Guard::~Guard()
+{
+    release();
+}
+
+void ConnectionPool::Guard::release()
+{
+    if (pool && connection) {
+        pool->checkIn(std::move(connection));
+    }
+    pool = nullptr;
+}
+
+ConnectionPool::ConnectionPool()
+    : available(DEFAULT_MAX_CONNECTIONS)
+    , maxConnections(DEFAULT_MAX_CONNECTIONS)
+    , healthCheckIdleMs(DEFAULT_HEALTH_CHECK_IDLE_MS)
+    , openConnections(0)
+    , nextConnectionNumber(1)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    closeAll();
+}
+
+void ConnectionPool::setConnectionParameters(const DatabaseManager::ConnectionParameters& parameters)
+{
+    QMutexLocker locker(&mutex);
+    connectionParameters = parameters;
+}
+
+void ConnectionPool::setStatsDumpFile(const QString& path)
+{
+    QMutexLocker locker(&mutex);
+    statsDumpFile = path;
+}
+
+void ConnectionPool::setMaxConnections(int count)
+{
+    if (count < 1) {
+        count = 1;
+    }
+
+    int difference;
+    {
+        QMutexLocker locker(&mutex);
+        difference = count - maxConnections;
+        maxConnections = count;
+    }
+
+    if (difference > 0) {
+        available.release(difference);
+    } else if (difference < 0) {
+        // Уменьшение ждёт возврата лишних выданных соединений
+        available.acquire(-difference);
+    }
+
+    qDebug() << "ConnectionPool: max connections set to" << count;
+}
+
+int ConnectionPool::getMaxConnections() const
+{
+    QMutexLocker locker(&mutex);
+    return maxConnections;
+}
+
+void ConnectionPool::setHealthCheckIdleMs(qint64 ms)
+{
+    QMutexLocker locker(&mutex);
+    healthCheckIdleMs = ms;
+}
+
+ConnectionPool::Guard ConnectionPool::acquire(int timeoutMs)
+{
+    if (!available.tryAcquire(1, timeoutMs)) {
+        setLastError(QString("Timed out waiting for a free connection (%1 ms)").arg(timeoutMs));
+        qDebug() << "ConnectionPool:" << getLastError();
+        return Guard();
+    }
+
+    std::unique_ptr<DatabaseManager> connection;
+    bool needsHealthCheck = false;
+    {
+        QMutexLocker locker(&mutex);
+        auto it = idleConnections.find(QThread::currentThreadId());
+        if (it != idleConnections.end() && !it->second.empty()) {
+            IdleConnection& idle = it->second.back();
+            needsHealthCheck = idle.idleTimer.elapsed() > healthCheckIdleMs;
+            connection = std::move(idle.connection);
+            it->second.pop_back();
+        }
+    }
+
+    if (connection && needsHealthCheck && !isHealthy(*connection)) {
+        // Соединение отвалилось за время простоя - переподключаемся под тем же именем
+        qDebug() << "ConnectionPool: idle connection failed health check, reconnecting";
+        DatabaseManager::ConnectionParameters parameters;
+        {
+            QMutexLocker locker(&mutex);
+            parameters = connectionParameters;
+        }
+        connection->disconnect();
+        if (!connection->initialize(parameters)) {
+            setLastError("Failed to reconnect pooled connection: " + connection->getLastError());
+            connection.reset();
+            QMutexLocker locker(&mutex);
+            openConnections--;
+        }
+    }
+
+    if (!connection) {
+        connection = createConnection();
+    }
+
+    if (!connection) {
+        available.release();
+        return Guard();
+    }
+
+    return Guard(this, std::move(connection));
+}
+
+void ConnectionPool::checkIn(std::unique_ptr<DatabaseManager> connection)
+{
+    {
+        QMutexLocker locker(&mutex);
+        // Лишние (или разорванные) соединения закрываем, остальные оставляем потоку
+        if (connection->isConnected() && openConnections <= maxConnections) {
+            IdleConnection idle;
+            idle.connection = std::move(connection);
+            idle.idleTimer.start();
+            idleConnections[QThread::currentThreadId()].push_back(std::move(idle));
+        } else {
+            openConnections--;
+        }
+    }
+
+    // Закрытие вне блокировки: disconnect может занять время
+    connection.reset();
+    available.release();
+}
+
+std::unique_ptr<DatabaseManager> ConnectionPool::createConnection()
+{
+    QString name;
+    DatabaseManager::ConnectionParameters parameters;
+    QString dumpFile;
+    {
+        QMutexLocker locker(&mutex);
+        name = QString("tube_pool_%1").arg(nextConnectionNumber++);
+        parameters = connectionParameters;
+        dumpFile = statsDumpFile;
+    }
+
+    std::unique_ptr<DatabaseManager> connection = std::make_unique<DatabaseManager>(name);
+    connection->setStatsDumpFile(dumpFile);
+    if (!connection->initialize(parameters)) {
+        setLastError("Failed to open pooled connection: " + connection->getLastError());
+        qDebug() << "ConnectionPool:" << getLastError();
+        return nullptr;
+    }
+
+    QMutexLocker locker(&mutex);
+    openConnections++;
+    qDebug() << "ConnectionPool: opened connection" << name << "open:" << openConnections;
+    return connection;
+}
+
+bool ConnectionPool::isHealthy(DatabaseManager& connection)
+{
+    if (!connection.isConnected()) {
+        return false;
+    }
+
+    QSqlQuery query = connection.executeQuery("SELECT 1");
+    return query.isActive() && query.next();
+}
+
+void ConnectionPool::releaseCurrentThreadConnections()
+{
+    std::vector<IdleConnection> connections;
+    {
+        QMutexLocker locker(&mutex);
+        auto it = idleConnections.find(QThread::currentThreadId());
+        if (it == idleConnections.end()) {
+            return;
+        }
+        connections = std::move(it->second);
+        idleConnections.erase(it);
+        openConnections -= static_cast<int>(connections.size());
+    }
+
+    qDebug() << "ConnectionPool: closing" << connections.size() << "connections of finished thread";
+}
+
+void ConnectionPool::closeAll()
+{
+    // Вызывается при завершении работы, когда рабочие потоки уже остановлены
+    std::map<Qt::HANDLE, std::vector<IdleConnection>> connections;
+    {
+        QMutexLocker locker(&mutex);
+        connections.swap(idleConnections);
+        for (const auto& entry : connections) {
+            openConnections -= static_cast<int>(entry.second.size());
+        }
+    }
+}
+
+int ConnectionPool::getOpenConnectionCount() const
+{
+    QMutexLocker locker(&mutex);
+    return openConnections;
+}
+
+QString ConnectionPool::getLastError() const
+{
+    QMutexLocker locker(&mutex);
+    return lastError;
+}
+
+void ConnectionPool::setLastError(const QString& error)
+{
+    QMutexLocker locker(&mutex);
+    lastError = error;
+}
@@ -0,0 +1,103 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include "databasemanager.h"
+#include <QMutex>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QString>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Пул именованных соединений с БД.
+// Соединение Qt SQL можно использовать только в создавшем его потоке,
+// поэтому свободные соединения хранятся отдельно для каждого потока.
+// Число одновременно выданных соединений ограничено размером пула.
+class ConnectionPool
+{
+public:
+    // RAII-обёртка над выданным соединением: при разрушении возвращает его в пул
+    class Guard
+    {
+    public:
+        Guard() = default;
+        Guard(ConnectionPool* pool, std::unique_ptr<DatabaseManager> connection);
+        Guard(Guard&& other) noexcept;
+        Guard& operator=(Guard&& other) noexcept;
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        ~Guard();
+
+        bool isValid() const { return connection != nullptr; }
+        DatabaseManager& operator*() const { return *connection; }
+        DatabaseManager* operator->() const { return connection.get(); }
+
+        // Досрочный возврат соединения в пул
+        void release();
+
+    private:
+        ConnectionPool* pool = nullptr;
+        std::unique_ptr<DatabaseManager> connection;
+    };
+
+    ConnectionPool();
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    void setConnectionParameters(const DatabaseManager::ConnectionParameters& parameters);
+
+    // Максимум одновременно выданных соединений
+    void setMaxConnections(int count);
+    int getMaxConnections() const;
+
+    // Соединение, простоявшее дольше этого времени, перед выдачей проверяется через SELECT 1
+    void setHealthCheckIdleMs(qint64 ms);
+
+    // Файл статистики операций для новых соединений (см. DatabaseManager::setStatsDumpFile)
+    void setStatsDumpFile(const QString& path);
+
+    // Выдаёт соединение для текущего потока. При превышении timeoutMs
+    // или ошибке подключения возвращает невалидный Guard (см. getLastError)
+    Guard acquire(int timeoutMs = DEFAULT_ACQUIRE_TIMEOUT_MS);
+
+    // Закрывает свободные соединения текущего потока (вызывать перед завершением потока)
+    void releaseCurrentThreadConnections();
+
+    // Закрывает все свободные соединения
+    void closeAll();
+
+    int getOpenConnectionCount() const;
+    QString getLastError() const;
+
+private:
+    struct IdleConnection {
+        std::unique_ptr<DatabaseManager> connection;
+        QElapsedTimer idleTimer;
+    };
+
+    static const int DEFAULT_MAX_CONNECTIONS = 4;
+    static const int DEFAULT_ACQUIRE_TIMEOUT_MS = 30000;
+    static const qint64 DEFAULT_HEALTH_CHECK_IDLE_MS = 30000;
+
+    void checkIn(std::unique_ptr<DatabaseManager> connection);
+    std::unique_ptr<DatabaseManager> createConnection();
+    bool isHealthy(DatabaseManager& connection);
+    void setLastError(const QString& error);
+
+    mutable QMutex mutex;
+    QSemaphore available;
+    DatabaseManager::ConnectionParameters connectionParameters;
+    QString statsDumpFile;
+    std::map<Qt::HANDLE, std::vector<IdleConnection>> idleConnections;
+    int maxConnections;
+    qint64 healthCheckIdleMs;
+    int openConnections;
+    int nextConnectionNumber;
+    QString lastError;
+};
+
+#endif // CONNECTIONPOOL_H
@@ -0,0 +1,66 @@
+#include "contoursweep.h"
+#include <algorithm>
+
+bool ContourSweep::edgesIntersect(const std::vector<Edge>& first, const std::vector<Edge>& second)
+{
+    std::vector<SweepEdge> edges;
+    edges.reserve(first.size() + second.size());
+    appendEdges(first, 0, edges);
+    appendEdges(second, 1, edges);
+    return sweep(edges, false);
+}
+
+bool ContourSweep::hasIntersectingEdges(const std::vector<Edge>& edges)
+{
+    std::vector<SweepEdge> sweepEdges;
+    sweepEdges.reserve(edges.size());
+    appendEdges(edges, 0, sweepEdges);
+    return sweep(sweepEdges, true);
+}
+
+void ContourSweep::appendEdges(const std::vector<Edge>& source, int group,
+                               std::vector<SweepEdge>& edges)
+{
+    for (const Edge& edge : source) {
+        const Point3D& start = edge.getStartPoint();
+        const Point3D& end = edge.getEndPoint();
+
+        SweepEdge sweepEdge{std::min(start.x, end.x), std::max(start.x, end.x),
+                            std::min(start.y, end.y), std::max(start.y, end.y),
+                            group, &edge};
+        edges.push_back(sweepEdge);
+    }
+}
+
+bool ContourSweep::sweep(std::vector<SweepEdge>& edges, bool sameGroup)
+{
+    std::sort(edges.begin(), edges.end(), [](const SweepEdge& a, const SweepEdge& b) {
+        return a.minX < b.minX;
+    });
+
+    // Рёбра, X-интервал которых ещё может перекрыться со следующими
+    std::vector<const SweepEdge*> active;
+    for (const SweepEdge& current : edges) {
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&current](const SweepEdge* other) {
+                                        return other->maxX < current.minX;
+                                    }),
+                     active.end());
+
+        for (const SweepEdge* other : active) {
+            if (!sameGroup && other->group == current.group) {
+                continue;
+            }
+            if (other->maxY < current.minY || current.maxY < other->minY) {
+                continue;
+            }
+            if (Edge::doIntersect(*other->edge, *current.edge)) {
+                return true;
+            }
+        }
+
+        active.push_back(&current);
+    }
+
+    return false;
+}
@@ -0,0 +1,34 @@
+#ifndef CONTOURSWEEP_H
+#define CONTOURSWEEP_H
+
+#include "edge.h"
+#include <vector>
+
+// Проверка пересечений наборов рёбер в проекции на XY: sweep-and-prune по оси X
+// (рёбра сортируются по левой границе, сравниваются только перекрывающиеся по X и Y),
+// точная проверка пары - Edge::doIntersect. В среднем O((n + m) log(n + m)) вместо O(n * m)
+class ContourSweep
+{
+public:
+    // Пересекает ли ребро первого набора ребро второго
+    static bool edgesIntersect(const std::vector<Edge>& first, const std::vector<Edge>& second);
+    // Пересекаются ли рёбра одного набора (рёбра с общей точкой не считаются)
+    static bool hasIntersectingEdges(const std::vector<Edge>& edges);
+
+private:
+    struct SweepEdge {
+        float minX;
+        float maxX;
+        float minY;
+        float maxY;
+        int group;
+        const Edge* edge;
+    };
+
+    static void appendEdges(const std::vector<Edge>& source, int group,
+                            std::vector<SweepEdge>& edges);
+    // sameGroup - сравнивать рёбра одного набора, иначе только рёбра разных наборов
+    static bool sweep(std::vector<SweepEdge>& edges, bool sameGroup);
+};
+
+#endif // CONTOURSWEEP_H
@@ -1,9 +1,27 @@
 #include "databasemanager.h"
+#include "connectionpool.h"
+#include "storagebackend.h"
 #include <QSqlDriver>
 #include <QStringList>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QFile>
+#include <algorithm>
 
 DatabaseManager::DatabaseManager()
-    : inTransaction(false)
+    : backend(StorageBackend::create("QPSQL"))
+    , inTransaction(false)
+    , instrumentationEnabled(true)
+    , operationDepth(0)
+{
+}
+
+DatabaseManager::DatabaseManager(const QString& connectionName)
+    : connectionName(connectionName)
+    , backend(StorageBackend::create("QPSQL"))
+    , inTransaction(false)
+    , instrumentationEnabled(true)
+    , operationDepth(0)
 {
 }
 
@@ -18,32 +36,74 @@ DatabaseManager& DatabaseManager::getInstance()
     return instance;
 }
 
+ConnectionPool& DatabaseManager::getConnectionPool()
+{
+    static ConnectionPool pool;
+    return pool;
+}
+
 bool DatabaseManager::initialize(const QString& host,
                                  int port,
                                  const QString& dbname,
                                  const QString& user,
                                  const QString& password)
+{
+    ConnectionParameters parameters;
+    parameters.driver = "QPSQL";
+    parameters.host = host;
+    parameters.port = port;
+    parameters.dbname = dbname;
+    parameters.user = user;
+    parameters.password = password;
+    return initialize(parameters);
+}
+
+bool DatabaseManager::initializeSqlite(const QString& filePath)
+{
+    ConnectionParameters parameters;
+    parameters.driver = "QSQLITE";
+    parameters.dbname = filePath;
+    return initialize(parameters);
+}
+
+bool DatabaseManager::initialize(const ConnectionParameters& parameters)
 {
     if (db.isOpen()) {
         disconnect();
     }
 
-     
-    db = QSqlDatabase::addDatabase("QPSQL");
-    db.setHostName(host);
-    db.setPort(port);
-    db.setDatabaseName(dbname);
-    db.setUserName(user);
-    db.setPassword(password);
+    std::unique_ptr<StorageBackend> selectedBackend = StorageBackend::create(parameters.driver);
+    if (!selectedBackend) {
+        setLastError(QString("Unsupported database driver: %1").arg(parameters.driver));
+        return false;
+    }
+    backend = std::move(selectedBackend);
+
+    // Синглтон использует соединение по умолчанию, остальные экземпляры - своё имя
+    db = connectionName.isEmpty() ? QSqlDatabase::addDatabase(backend->getDriverName())
+                                  : QSqlDatabase::addDatabase(backend->getDriverName(), connectionName);
+    backend->configureConnection(db, parameters.host, parameters.port, parameters.dbname,
+                                 parameters.user, parameters.password);
 
     if (!db.open()) {
         setLastError(QString("Connection failed: %1").arg(db.lastError().text()));
         return false;
     }
 
-    qDebug() << "Successfully connected to database:" << dbname;
+    if (!prepareSession()) {
+        disconnect();
+        return false;
+    }
+
+    connectionParameters = parameters;
+
+    if (connectionName.isEmpty()) {
+        getConnectionPool().setConnectionParameters(connectionParameters);
+    }
+
+    qDebug() << "Successfully connected to database:" << parameters.dbname
+             << "driver:" << parameters.driver;
 
-     
     if (!checkDatabaseStructure()) {
         qWarning() << "Warning: Database structure check failed or incomplete";
     }
@@ -51,6 +111,28 @@ bool DatabaseManager::initialize(const QString& host,
     return true;
 }
 
+bool DatabaseManager::prepareSession()
+{
+    // Настройки соединения и (для встроенной БД) создание недостающих таблиц
+    for (const QString& statement : backend->getSessionStatements() + backend->getSchemaStatements()) {
+        if (!execute(statement)) {
+            setLastError("Failed to prepare database session: " + lastError);
+            return false;
+        }
+    }
+    return true;
+}
+
+DatabaseManager::ConnectionParameters DatabaseManager::getConnectionParameters() const
+{
+    return connectionParameters;
+}
+
+const StorageBackend& DatabaseManager::getBackend() const
+{
+    return *backend;
+}
+
 bool DatabaseManager::isConnected() const
 {
     return db.isOpen();
@@ -63,9 +145,14 @@ void DatabaseManager::disconnect()
             rollbackTransaction();
         }
 
-        QString connectionName = db.connectionName();
+        // Подготовленные запросы должны быть освобождены до закрытия соединения
+        clearPreparedQueries();
+
+        QString name = db.connectionName();
         db.close();
-        QSqlDatabase::removeDatabase(connectionName);
+        // Дескриптор нужно отпустить, иначе removeDatabase сочтёт соединение занятым
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
 
         qDebug() << "Database connection closed";
     }
@@ -79,7 +166,12 @@ bool DatabaseManager::execute(const QString& query)
     }
 
     QSqlQuery q(db);
-    if (!q.exec(query)) {
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = q.exec(query);
+    recordStatement(query, timer.nsecsElapsed(), &q);
+
+    if (!ok) {
         setLastError(QString("Query execution failed: %1\nQuery: %2")
                          .arg(q.lastError().text())
                          .arg(query));
@@ -100,7 +192,12 @@ QSqlQuery DatabaseManager::executeQuery(const QString& query)
         return q;
     }
 
-    if (!q.exec(query)) {
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = q.exec(query);
+    recordStatement(query, timer.nsecsElapsed(), &q);
+
+    if (!ok) {
         setLastError(QString("Query execution failed: %1\nQuery: %2")
                          .arg(q.lastError().text())
                          .arg(query));
@@ -111,6 +208,74 @@ QSqlQuery DatabaseManager::executeQuery(const QString& query)
     return q;
 }
 
+QSqlQuery* DatabaseManager::getPreparedQuery(const QString& name, const QString& sql)
+{
+    if (!checkConnection()) {
+        setLastError("Not connected to database");
+        return nullptr;
+    }
+
+    auto it = preparedQueries.find(name);
+    if (it != preparedQueries.end()) {
+        return &it->second;
+    }
+
+    QSqlQuery q(db);
+    if (!q.prepare(sql)) {
+        setLastError(QString("Failed to prepare query %1: %2\nQuery: %3")
+                         .arg(name)
+                         .arg(q.lastError().text())
+                         .arg(sql));
+        qDebug() << "Error:" << lastError;
+        return nullptr;
+    }
+
+    qDebug() << "Prepared query" << name;
+    return &preparedQueries.emplace(name, q).first->second;
+}
+
+std::unique_ptr<QSqlQuery> DatabaseManager::prepareQuery(const QString& sql)
+{
+    if (!checkConnection()) {
+        setLastError("Not connected to database");
+        return nullptr;
+    }
+
+    auto q = std::make_unique<QSqlQuery>(db);
+    if (!q->prepare(sql)) {
+        setLastError(QString("Failed to prepare query: %1\nQuery: %2")
+                         .arg(q->lastError().text())
+                         .arg(sql));
+        qDebug() << "Error:" << lastError;
+        return nullptr;
+    }
+
+    return q;
+}
+
+bool DatabaseManager::executePrepared(QSqlQuery& query)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = query.exec();
+    recordStatement(query.lastQuery(), timer.nsecsElapsed(), &query);
+
+    if (!ok) {
+        setLastError(QString("Prepared query execution failed: %1\nQuery: %2")
+                         .arg(query.lastError().text())
+                         .arg(query.lastQuery()));
+        qDebug() << "Error:" << lastError;
+        return false;
+    }
+
+    return true;
+}
+
+void DatabaseManager::clearPreparedQueries()
+{
+    preparedQueries.clear();
+}
+
 QString DatabaseManager::getLastError() const
 {
     return lastError;
@@ -150,7 +315,13 @@ bool DatabaseManager::commitTransaction()
         return false;
     }
 
-    if (db.commit()) {
+    // В commit выполняются отложенные триггеры, поэтому он тоже учитывается
+    QElapsedTimer timer;
+    timer.start();
+    bool committed = db.commit();
+    recordStatement("COMMIT", timer.nsecsElapsed(), nullptr);
+
+    if (committed) {
         inTransaction = false;
         qDebug() << "Transaction committed";
         return true;
@@ -191,13 +362,46 @@ int64_t DatabaseManager::getLastInsertedId()
     }
 
     QSqlQuery q(db);
-    if (q.exec("SELECT lastval()") && q.next()) {
+    if (q.exec(backend->lastInsertIdQuery()) && q.next()) {
         return q.value(0).toLongLong();
     }
 
     return -1;
 }
 
+std::vector<int64_t> DatabaseManager::reserveSequenceIds(const QString& table, int count)
+{
+    std::vector<int64_t> ids;
+
+    if (count <= 0) {
+        return ids;
+    }
+
+    if (!checkConnection()) {
+        return ids;
+    }
+
+    QString query = backend->sequenceReservationQuery(table, count);
+    if (query.isEmpty()) {
+        setLastError(QString("Id reservation is not supported by %1").arg(backend->getDriverName()));
+        return ids;
+    }
+
+    QSqlQuery q = executeQuery(query);
+
+    ids.reserve(static_cast<size_t>(count));
+    while (q.next()) {
+        ids.push_back(q.value(0).toLongLong());
+    }
+
+    if (static_cast<int>(ids.size()) != count) {
+        setLastError(QString("Failed to reserve %1 ids for table %2").arg(count).arg(table));
+        ids.clear();
+    }
+
+    return ids;
+}
+
 QString DatabaseManager::escapeString(const QString& str) const
 {
      
@@ -213,28 +417,245 @@ bool DatabaseManager::checkDatabaseStructure()
         return false;
     }
 
-     
+    // Основные таблицы создаёт data/DBMaker.sql; остальное добавляют миграции
     QStringList tables = {"tube", "section", "segment", "point", "edge"};
 
     for (const QString& table : tables) {
-        QString query = QString(
-                            "SELECT EXISTS ("
-                            "   SELECT FROM information_schema.tables "
-                            "   WHERE table_schema = 'public' "
-                            "   AND table_name = '%1'"
-                            ")").arg(table);
-
-        QSqlQuery q = executeQuery(query);
-        if (!q.next() || !q.value(0).toBool()) {
+        if (!tableExists(table)) {
             qWarning() << "Table does not exist:" << table;
             return false;
         }
     }
 
+    if (!migrateSchema()) {
+        qWarning() << "Schema migration failed:" << lastError;
+        return false;
+    }
+
+    if (!tableExists("point_delta")) {
+        qWarning() << "Table does not exist: point_delta";
+        return false;
+    }
+
     qDebug() << "Database structure check passed";
     return true;
 }
 
+bool DatabaseManager::tableExists(const QString& table)
+{
+    QSqlQuery q = executeQuery(backend->tableExistsQuery(table));
+    return q.next() && q.value(0).toBool();
+}
+
+int DatabaseManager::getSchemaVersion()
+{
+    QSqlQuery q = executeQuery("SELECT COALESCE(MAX(version), 0) FROM schema_version");
+    if (!q.next()) {
+        setLastError("Failed to read schema version: " + lastError);
+        return -1;
+    }
+    return q.value(0).toInt();
+}
+
+bool DatabaseManager::migrateSchema()
+{
+    const std::vector<StorageBackend::SchemaMigration> migrations = backend->getMigrations();
+    if (migrations.empty()) {
+        return true;
+    }
+
+    if (!execute("CREATE TABLE IF NOT EXISTS schema_version ("
+                 "    version integer primary key,"
+                 "    description text not null,"
+                 "    applied_at timestamp not null default current_timestamp"
+                 ")")) {
+        setLastError("Failed to create schema_version table: " + lastError);
+        return false;
+    }
+
+    int currentVersion = getSchemaVersion();
+    if (currentVersion == -1) {
+        return false;
+    }
+
+    for (const StorageBackend::SchemaMigration& migration : migrations) {
+        if (migration.version <= currentVersion) {
+            continue;
+        }
+
+        qDebug() << "Applying schema migration" << migration.version << ":" << migration.description;
+
+        // Каждая миграция - в своей транзакции вместе с записью в schema_version
+        if (!beginTransaction()) {
+            return false;
+        }
+
+        bool applied = true;
+        for (const QString& statement : migration.statements) {
+            if (!execute(statement)) {
+                applied = false;
+                break;
+            }
+        }
+
+        applied = applied && execute(QString("INSERT INTO schema_version (version, description) "
+                                             "VALUES (%1, '%2')")
+                                         .arg(migration.version)
+                                         .arg(escapeString(migration.description)));
+
+        if (!applied || !commitTransaction()) {
+            QString error = lastError;
+            if (inTransaction) {
+                rollbackTransaction();
+            }
+            setLastError(QString("Schema migration %1 failed: %2").arg(migration.version).arg(error));
+            return false;
+        }
+
+        currentVersion = migration.version;
+    }
+
+    qDebug() << "Database schema version:" << currentVersion;
+    return true;
+}
+
+QJsonObject DatabaseManager::OperationStats::toJson() const
+{
+    QJsonArray slowest;
+    for (const StatementTiming& statement : slowestStatements) {
+        QJsonObject item;
+        item["sql"] = statement.sql;
+        item["driver_ms"] = statement.driverNs / 1e6;
+        item["rows"] = statement.rows;
+        slowest.append(item);
+    }
+
+    QJsonObject json;
+    json["operation"] = name;
+    json["statements"] = statementCount;
+    json["rows_returned"] = rowsReturned;
+    json["rows_affected"] = rowsAffected;
+    json["total_ms"] = totalNs / 1e6;
+    json["driver_ms"] = driverNs / 1e6;
+    json["client_ms"] = getClientNs() / 1e6;
+    json["slowest"] = slowest;
+    return json;
+}
+
+DatabaseManager::OperationScope::OperationScope(DatabaseManager& manager, const QString& name)
+    : manager(manager)
+{
+    manager.beginOperation(name);
+}
+
+DatabaseManager::OperationScope::~OperationScope()
+{
+    manager.endOperation();
+}
+
+void DatabaseManager::setInstrumentationEnabled(bool enabled)
+{
+    instrumentationEnabled = enabled;
+}
+
+bool DatabaseManager::isInstrumentationEnabled() const
+{
+    return instrumentationEnabled;
+}
+
+void DatabaseManager::setStatsDumpFile(const QString& path)
+{
+    statsDumpFile = path;
+}
+
+const DatabaseManager::OperationStats& DatabaseManager::getLastOperationStats() const
+{
+    return lastOperation;
+}
+
+void DatabaseManager::beginOperation(const QString& name)
+{
+    // Учитывается только внешняя область
+    if (operationDepth++ > 0 || !instrumentationEnabled) {
+        return;
+    }
+
+    currentOperation = OperationStats();
+    currentOperation.name = name;
+    operationTimer.start();
+}
+
+void DatabaseManager::endOperation()
+{
+    if (operationDepth == 0 || --operationDepth > 0 || !operationTimer.isValid()) {
+        return;
+    }
+
+    currentOperation.totalNs = operationTimer.nsecsElapsed();
+    operationTimer.invalidate();
+    lastOperation = currentOperation;
+
+    qDebug() << "SQL stats:" << lastOperation.name
+             << "statements" << lastOperation.statementCount
+             << "rows" << lastOperation.rowsReturned << "/" << lastOperation.rowsAffected
+             << "total" << lastOperation.totalNs / 1e6 << "ms"
+             << "driver" << lastOperation.driverNs / 1e6 << "ms"
+             << "client" << lastOperation.getClientNs() / 1e6 << "ms";
+
+    if (statsDumpFile.isEmpty()) {
+        return;
+    }
+
+    QFile file(statsDumpFile);
+    if (!file.open(QIODevice::Append | QIODevice::Text)) {
+        qDebug() << "Failed to open stats dump file:" << statsDumpFile;
+        return;
+    }
+    // Одна запись на строку: файл могут дописывать несколько соединений пула
+    QByteArray line = QJsonDocument(lastOperation.toJson()).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    file.write(line);
+}
+
+void DatabaseManager::recordStatement(const QString& sql, qint64 driverNs, const QSqlQuery* query)
+{
+    if (!instrumentationEnabled || operationDepth == 0 || !operationTimer.isValid()) {
+        return;
+    }
+
+    int rows = 0;
+    if (query && query->isActive() && query->isSelect()) {
+        // size() = -1, если драйвер не сообщает число строк (QSQLITE)
+        rows = std::max(query->size(), 0);
+        currentOperation.rowsReturned += rows;
+    } else if (query) {
+        rows = std::max(query->numRowsAffected(), 0);
+        currentOperation.rowsAffected += rows;
+    }
+
+    currentOperation.statementCount++;
+    currentOperation.driverNs += driverNs;
+
+    std::vector<StatementTiming>& slowest = currentOperation.slowestStatements;
+    if (static_cast<int>(slowest.size()) == MAX_SLOW_STATEMENTS && slowest.back().driverNs >= driverNs) {
+        return;
+    }
+
+    StatementTiming timing;
+    timing.sql = sql.left(MAX_STATEMENT_TEXT);
+    timing.driverNs = driverNs;
+    timing.rows = rows;
+
+    auto position = std::upper_bound(slowest.begin(), slowest.end(), timing,
+                                     [](const StatementTiming& a, const StatementTiming& b) {
+                                         return a.driverNs > b.driverNs;
+                                     });
+    slowest.insert(position, timing);
+    if (static_cast<int>(slowest.size()) > MAX_SLOW_STATEMENTS) {
+        slowest.pop_back();
+    }
+}
+
 void DatabaseManager::setLastError(const QString& error)
 {
     lastError = error;
@@ -266,6 +687,7 @@ bool DatabaseManager::clearAllTables()
     }
 
     QStringList deleteQueries = {
+        "DELETE FROM point_delta",
         "DELETE FROM point",
         "DELETE FROM section",
         "DELETE FROM edge",
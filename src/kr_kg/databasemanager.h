@@ -7,12 +7,75 @@
 #include <QString>
 #include <QVariant>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <vector>
+#include <map>
+#include <memory>
+
+class ConnectionPool;
+class StorageBackend;
 
 class DatabaseManager
 {
 public:
+    // Параметры подключения, с которыми был вызван initialize
+    struct ConnectionParameters {
+        // Драйвер Qt: "QPSQL" или "QSQLITE" (для SQLite dbname - путь к файлу)
+        QString driver = "QPSQL";
+        QString host = "localhost";
+        int port = 5432;
+        QString dbname = "tube_deformation";
+        QString user = "postgres";
+        QString password = "12345";
+    };
+
+    // Время одного оператора в драйвере
+    struct StatementTiming {
+        QString sql;
+        qint64 driverNs = 0;
+        int rows = 0;
+    };
+
+    // Статистика логической операции (save, load, link, delete)
+    struct OperationStats {
+        QString name;
+        int statementCount = 0;
+        qint64 rowsReturned = 0;
+        qint64 rowsAffected = 0;
+        qint64 totalNs = 0;
+        qint64 driverNs = 0;
+        // Самые долгие операторы, по убыванию driverNs
+        std::vector<StatementTiming> slowestStatements;
+
+        // Время вне драйвера: разбор результатов, построение объектов, логика C++
+        qint64 getClientNs() const { return totalNs - driverNs; }
+        QJsonObject toJson() const;
+    };
+
+    // Всё, что выполнено через DatabaseManager внутри области, относится к операции name.
+    // Вложенные области учитываются во внешней.
+    class OperationScope
+    {
+    public:
+        OperationScope(DatabaseManager& manager, const QString& name);
+        ~OperationScope();
+        OperationScope(const OperationScope&) = delete;
+        OperationScope& operator=(const OperationScope&) = delete;
+
+    private:
+        DatabaseManager& manager;
+    };
+
     static DatabaseManager& getInstance();
 
+    // Пул соединений для рабочих потоков; параметры берутся из initialize синглтона
+    static ConnectionPool& getConnectionPool();
+
+    // Отдельное именованное соединение (например, для фонового потока).
+    // Использовать только в потоке, где объект создан.
+    explicit DatabaseManager(const QString& connectionName);
+
     DatabaseManager(const DatabaseManager&) = delete;
     DatabaseManager& operator=(const DatabaseManager&) = delete;
 
@@ -22,6 +85,14 @@ public:
                     const QString& user = "postgres",
                     const QString& password = "12345");
 
+    bool initialize(const ConnectionParameters& parameters);
+    // Локальный файл SQLite; схема создаётся при первом подключении
+    bool initializeSqlite(const QString& filePath);
+    ConnectionParameters getConnectionParameters() const;
+
+    // Диалект и возможности текущей СУБД
+    const StorageBackend& getBackend() const;
+
     bool isConnected() const;
     void disconnect();
 
@@ -36,8 +107,29 @@ public:
 
     int64_t getLastInsertedId();
 
+    // Резервирует count значений из bigserial-последовательности таблицы одним запросом
+    std::vector<int64_t> reserveSequenceIds(const QString& table, int count);
+
+    // Кэш подготовленных запросов: запрос готовится при первом обращении по имени
+    // и переиспользуется до разрыва соединения. Возвращает nullptr при ошибке prepare.
+    QSqlQuery* getPreparedQuery(const QString& name, const QString& sql);
+    // Разовый подготовленный запрос без кэширования (например, неполная пачка строк).
+    // Возвращает nullptr при ошибке prepare.
+    std::unique_ptr<QSqlQuery> prepareQuery(const QString& sql);
+    bool executePrepared(QSqlQuery& query);
+    void clearPreparedQueries();
+
+    void setInstrumentationEnabled(bool enabled);
+    bool isInstrumentationEnabled() const;
+    // Если путь задан, после каждой операции в файл дописывается строка JSON
+    void setStatsDumpFile(const QString& path);
+    const OperationStats& getLastOperationStats() const;
+
     QString escapeString(const QString& str) const;
+    // Проверяет таблицы и применяет недостающие миграции схемы (см. StorageBackend::getMigrations)
     bool checkDatabaseStructure();
+    // Последняя применённая миграция из schema_version; -1 при ошибке
+    int getSchemaVersion();
 
     ~DatabaseManager();
 
@@ -47,11 +139,32 @@ private:
     DatabaseManager();
 
     QSqlDatabase db;
+    QString connectionName;
+    ConnectionParameters connectionParameters;
+    std::unique_ptr<StorageBackend> backend;
     QString lastError;
     bool inTransaction;
+    std::map<QString, QSqlQuery> preparedQueries;
+
+    static const int MAX_SLOW_STATEMENTS = 5;
+    static const int MAX_STATEMENT_TEXT = 300;
+
+    bool instrumentationEnabled;
+    int operationDepth;
+    OperationStats currentOperation;
+    OperationStats lastOperation;
+    QElapsedTimer operationTimer;
+    QString statsDumpFile;
+
+    void beginOperation(const QString& name);
+    void endOperation();
+    void recordStatement(const QString& sql, qint64 driverNs, const QSqlQuery* query);
 
     void setLastError(const QString& error);
     bool checkConnection();
+    bool prepareSession();
+    bool tableExists(const QString& table);
+    bool migrateSchema();
 };
 
 #endif
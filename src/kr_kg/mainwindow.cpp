@@ -1,6 +1,8 @@
 #include "mainwindow.h"
 #include "databasemanager.h"
 #include "tuberepository.h"
+#include "tubepersistenceworker.h"
+#include "tubeversionprefetcher.h"
 #include "./ui_mainwindow.h"
 #include <QMessageBox>
 #include <QInputDialog>
@@ -16,6 +18,10 @@
 #include <QDialogButtonBox>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <QThread>
+#include <QStatusBar>
+#include <QStandardPaths>
+#include <memory>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -72,14 +78,61 @@ MainWindow::MainWindow(QWidget *parent)
     DatabaseManager& db = DatabaseManager::getInstance();
     if (!db.initialize("localhost", 5432, "tube_deformation", "postgres", "12345")) {
         qWarning() << "Failed to initialize database connection:" << db.getLastError();
+
+        // Без сервера PostgreSQL работаем с локальным файлом SQLite
+        QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+        QDir().mkpath(dataDir);
+        QString sqlitePath = QDir(dataDir).filePath("tube_deformation.sqlite");
+        if (db.initializeSqlite(sqlitePath)) {
+            qDebug() << "Using local SQLite database:" << sqlitePath;
+        } else {
+            qWarning() << "Failed to open local SQLite database:" << db.getLastError();
+        }
     }
 
+    // Статистика SQL по операциям (JSON Lines), если задан TUBE_SQL_STATS_FILE
+    QString statsFile = qEnvironmentVariable("TUBE_SQL_STATS_FILE");
+    if (!statsFile.isEmpty()) {
+        db.setStatsDumpFile(statsFile);
+        DatabaseManager::getConnectionPool().setStatsDumpFile(statsFile);
+    }
+
+    // Сохранение версий выполняется в отдельном потоке со своим соединением
+    persistenceThread = new QThread(this);
+    persistenceWorker = new TubePersistenceWorker();
+    persistenceWorker->setKeyframeInterval(VERSION_KEYFRAME_INTERVAL);
+    persistenceWorker->moveToThread(persistenceThread);
+    connect(persistenceThread, &QThread::finished,
+            persistenceWorker, &QObject::deleteLater);
+    connect(persistenceWorker, &TubePersistenceWorker::tubeSaved,
+            this, &MainWindow::onTubeSaved);
+    connect(persistenceWorker, &TubePersistenceWorker::saveFailed,
+            this, &MainWindow::onTubeSaveFailed);
+    persistenceThread->start();
+
+    versionPrefetcher = new TubeVersionPrefetcher(versionCache);
+    versionPrefetcher->setDepth(VERSION_PREFETCH_DEPTH);
+    versionPrefetcher->setByteBudget(VERSION_PREFETCH_BUDGET_BYTES);
+
     connect(ui->deformationpushButton, &QPushButton::clicked,
             this, &MainWindow::applyTubeDeformation);
 }
 
 MainWindow::~MainWindow()
 {
+    // Предзагрузка обращается к versionCache, останавливаем её первой
+    delete versionPrefetcher;
+
+    if (persistenceThread) {
+        // Дописываем поставленные версии, затем останавливаем поток
+        persistenceWorker->waitForIdle();
+        persistenceThread->quit();
+        persistenceThread->wait();
+    }
+
+    // Рабочие потоки остановлены: закрываем оставшиеся соединения пула сейчас,
+    // а не при разрушении статических объектов после QApplication
+    DatabaseManager::getConnectionPool().closeAll();
     delete ui;
 }
 
@@ -96,6 +149,11 @@ void MainWindow::closeEvent(QCloseEvent *event)
     if (msgBox.exec() == QMessageBox::Yes) {
         event->accept();
 
+        // Очистка не должна пересечься с ещё идущим фоновым сохранением
+        if (persistenceWorker) {
+            persistenceWorker->waitForIdle();
+        }
+
         DatabaseManager& db = DatabaseManager::getInstance();
         if (db.isConnected()) {
             qDebug() << "Clearing database tables...";
@@ -712,10 +770,10 @@ void MainWindow::on_showTubeButton_clicked()
     }
 
     if (tubeResult.success) {
+        // Запись идёт в фоне, результат придёт в onTubeSaved / onTubeSaveFailed
         bool saved = saveTubeToDatabase(tube);
         if (saved) {
-            QMessageBox::information(this, "Успех",
-                                     "Трубка визуализирована и сохранена в БД!");
+            statusBar()->showMessage("Трубка визуализирована, идёт сохранение в БД...");
             tubeSavedToDatabase = true;
         } else {
             QMessageBox::warning(this, "Ошибка",
@@ -1704,7 +1762,9 @@ void MainWindow::on_pointAddBushButton_clicked()
         return;
     }
 
-    if (currentTubeId != -1) {
+    // Пока идут фоновые сохранения, пользователь стоит на последней версии:
+    // "будущие" версии - это ещё не записанные задачи, удалять их нельзя
+    if (currentTubeId != -1 && pendingSaveJobs == 0) {
         TubeRepository repository;
         int64_t futureId = repository.getFutureTubeId(currentTubeId);
 
@@ -1726,6 +1786,8 @@ void MainWindow::on_pointAddBushButton_clicked()
                 return;
             }
 
+            versionCache.invalidateFutureOf(currentTubeId);
+            versionPrefetcher->invalidate();
             qDebug() << "Future versions deleted successfully";
             updateVersionNavigationButtons();
         }
@@ -2153,74 +2215,79 @@ void MainWindow::applyPreviewDeformation()
 
 bool MainWindow::saveTubeToDatabase(const Tube& tube)
 {
-    qDebug() << "MainWindow::saveTubeToDatabase - Starting save operation";
-
-    DatabaseManager& db = DatabaseManager::getInstance();
-    if (!db.isConnected()) {
-        qDebug() << "Database is not connected, attempting to initialize...";
-        if (!db.initialize("localhost", 5432, "tube_deformation", "postgres", "12345")) {
-            qDebug() << "Failed to connect to database:" << db.getLastError();
-            return false;
-        }
-        qDebug() << "Database connection established successfully";
-    }
-
-    TubeRepository repository;
-
-    // Определяем ID предыдущей трубки
-    int64_t previousTubeId = -1;
-
-    // Если это не первое сохранение, получаем ID предыдущей версии
-    if (currentTubeId != -1) {
+    qDebug() << "MainWindow::saveTubeToDatabase - Queueing save operation";
+
+    // Если в очереди уже есть версии или текущая версия получена сохранением (а не загружена
+    // навигацией), новая привязывается к результату последней задачи: записанное содержимое
+    // этой версии, с которым сравнивается дельта, известно только воркеру
+    qint64 previousTubeId = -1;
+    std::shared_ptr<const Tube> previousTube;
+    if (pendingSaveJobs > 0 || (currentTubeId != -1 && !currentTubeSnapshot)) {
+        previousTubeId = TubePersistenceWorker::CHAIN_TO_PREVIOUS_JOB;
+        qDebug() << "Previous tube was saved in background, chaining to the last job";
+    } else if (currentTubeId != -1) {
         previousTubeId = currentTubeId;
+        previousTube = currentTubeSnapshot;
         qDebug() << "Previous tube ID:" << previousTubeId;
     } else {
         qDebug() << "This is the first tube version, no previous tube ID";
     }
 
-    qDebug() << "Calling repository.saveTube with verId:" << currentVersionId
-             << "previousTubeId:" << previousTubeId;
-
-    // Сохраняем трубку с указанием предыдущей версии
-    int64_t newTubeId = repository.saveTube(tube, currentVersionId, previousTubeId);
+    return enqueueTubeSave(tube, previousTubeId, previousTube);
+}
 
-    if (newTubeId == -1) {
-        QString errorMsg = repository.getLastError();
-        qDebug() << "Failed to save tube to database:" << errorMsg;
+bool MainWindow::enqueueTubeSave(const Tube& tube, qint64 previousTubeId,
+                                 std::shared_ptr<const Tube> previousTube)
+{
+    if (!persistenceWorker) {
+        qDebug() << "Persistence worker is not running";
         return false;
     }
 
-    qDebug() << "Tube saved successfully to database with id:" << newTubeId;
+    // Воркер получает собственную копию: дальнейшие изменения трубки его не затрагивают
+    std::shared_ptr<const Tube> snapshot = std::make_shared<const Tube>(tube);
+    int jobId = persistenceWorker->enqueueSave(snapshot, currentVersionId, previousTubeId,
+                                               std::move(previousTube));
+    pendingSaveJobs++;
 
-    // Если есть предыдущая версия, связываем трубки и их сущности
-    if (previousTubeId != -1) {
-        qDebug() << "Linking tube versions:" << previousTubeId << "->" << newTubeId;
+    qDebug() << "Save job" << jobId << "queued with verId:" << currentVersionId
+             << "previousTubeId:" << previousTubeId;
 
-        // Связываем сами трубки через future_tube_id и past_tube_id
-        if (!repository.linkTubeVersions(previousTubeId, newTubeId)) {
-            qDebug() << "Warning: Failed to link tube versions:" << repository.getLastError();
-            // Не критично, продолжаем
-        } else {
-            qDebug() << "Tube versions linked successfully";
-        }
+    updateVersionNavigationButtons();
+    return true;
+}
 
-        // Связываем все сущности (sections, segments, points, edges)
-        if (!repository.linkVersionEntities(previousTubeId, newTubeId)) {
-            qDebug() << "Warning: Failed to link version entities:" << repository.getLastError();
-            // Не критично, продолжаем
-        } else {
-            qDebug() << "Version entities linked successfully";
-        }
-    }
+void MainWindow::onTubeSaved(int jobId, qint64 tubeId, int verId, qint64 elapsedMs)
+{
+    pendingSaveJobs--;
+
+    // Задачи выполняются по порядку, поэтому последняя завершённая - самая новая версия.
+    // У её предшественника появилась future-связь, закэшированная запись устарела
+    versionCache.invalidate(currentTubeId);
+    versionPrefetcher->invalidate();
+    currentTubeId = tubeId;
+    currentTubeSnapshot = nullptr;
+    qDebug() << "Save job" << jobId << "finished: tube" << tubeId << "ver_id:" << verId
+             << "in" << elapsedMs << "ms";
 
-    // Обновляем текущий ID трубки
-    currentTubeId = newTubeId;
-    qDebug() << "Current tube ID updated to:" << currentTubeId;
+    if (pendingSaveJobs == 0) {
+        statusBar()->showMessage(QString("Версия %1 сохранена в БД").arg(verId), 3000);
+    }
 
-    // Обновляем кнопки навигации по версиям
     updateVersionNavigationButtons();
+}
 
-    return true;
+void MainWindow::onTubeSaveFailed(int jobId, int verId, const QString& error)
+{
+    pendingSaveJobs--;
+    qDebug() << "Save job" << jobId << "failed:" << error;
+    // Воркер продолжит цепочку от предшественника неудавшейся версии
+    currentTubeSnapshot = nullptr;
+
+    QMessageBox::warning(this, "Ошибка",
+                         QString("Не удалось сохранить версию %1 в БД:\n%2").arg(verId).arg(error));
+
+    updateVersionNavigationButtons();
 }
 
 void MainWindow::applyTubeDeformation()
@@ -2284,8 +2351,7 @@ void MainWindow::applyTubeDeformation()
                 return;
             }
             tubeSavedToDatabase = true;
-            qDebug() << "Original tube saved successfully with ver_id:" << currentVersionId
-                     << "tube_id:" << currentTubeId;
+            qDebug() << "Original tube queued for saving with ver_id:" << currentVersionId;
         }
 
         // Сохраняем ID предыдущей трубки ПЕРЕД деформацией
@@ -2355,48 +2421,24 @@ void MainWindow::applyTubeDeformation()
         qDebug() << "Saving deformed tube to database with ver_id:" << currentVersionId;
         qDebug() << "  Previous tube ID:" << previousTubeId;
 
-        // ВАЖНО: saveTubeToDatabase теперь использует previousTubeId внутри
-        // Но мы должны убедиться, что currentTubeId еще содержит previousTubeId
-        int64_t savedPreviousTubeId = currentTubeId; // Сохраняем перед вызовом saveTubeToDatabase
-
         if (!saveTubeToDatabase(tube)) {
             QMessageBox::critical(this, "Ошибка",
                                   "Не удалось сохранить деформированную трубку в базу данных.");
-            qDebug() << "Failed to save deformed tube to database";
+            qDebug() << "Failed to queue deformed tube save";
             currentVersionId--; // Откатываем версию
             return;
         }
 
-        qDebug() << "Deformed tube saved to database successfully";
-        qDebug() << "  Previous tube ID:" << savedPreviousTubeId;
-        qDebug() << "  New tube ID:" << currentTubeId;
-
-        // saveTubeToDatabase уже вызывает linkTubeVersions и linkVersionEntities
-        // Но на всякий случай проверим, что связи установлены
-        qDebug() << "Verifying tube version links...";
-
-        TubeRepository verifyRepository;
-        int64_t linkedFutureId = verifyRepository.getFutureTubeId(savedPreviousTubeId);
-        int64_t linkedPastId = verifyRepository.getPastTubeId(currentTubeId);
-
-        qDebug() << "  Previous tube's future_id:" << linkedFutureId << "(expected:" << currentTubeId << ")";
-        qDebug() << "  Current tube's past_id:" << linkedPastId << "(expected:" << savedPreviousTubeId << ")";
-
-        if (linkedFutureId != currentTubeId || linkedPastId != savedPreviousTubeId) {
-            qWarning() << "WARNING: Tube version links are not properly set!";
-        } else {
-            qDebug() << "Tube version links verified successfully";
-        }
-
+        // Связывание версий и его проверка выполняются в потоке сохранения
         tubeSavedToDatabase = true;
-        qDebug() << "Deformed tube saved to database successfully with ver_id:" << currentVersionId;
+        qDebug() << "Deformed tube queued for saving with ver_id:" << currentVersionId;
 
         QMessageBox::information(this, "Успех",
                                  QString("Деформация успешно применена!\n\n"
                                          "Создана новая версия трубки (версия %1).\n"
                                          "Сечений: %2\n"
                                          "Сегментов: %3\n"
-                                         "Данные сохранены в базу данных.")
+                                         "Данные сохраняются в базу данных.")
                                      .arg(currentVersionId)
                                      .arg(tube.getSectionCount())
                                      .arg(tube.getSegmentCount()));
@@ -2604,22 +2646,14 @@ bool MainWindow::insertCrossSectionIntoTube(Tube& tube, const Section& newSectio
 
 
     currentVersionId++;
-    TubeRepository tubeRepository;
-    int64_t tubeId = tubeRepository.saveTube(tube, currentVersionId, -1);
-    if (tubeId != -1) {
-        currentTubeId = tubeId;
-        qDebug() << "Tube saved successfully to database with id:" << tubeId;
-    }
-
-    if (tubeId == -1) {
-        qDebug() << "ERROR: Failed to save tube to database";
+    // Трубка с новым сечением сохраняется без связи с предыдущей версией
+    if (!enqueueTubeSave(tube, -1)) {
+        qDebug() << "ERROR: Failed to queue tube save";
         QMessageBox::critical(this, "Ошибка",
                               "Не удалось сохранить обновлённую трубку в базу данных!");
         return false;
     }
 
-    qDebug() << "Tube saved to database with ID:" << tubeId;
-
     return true;
 }
 
@@ -2634,8 +2668,7 @@ void MainWindow::on_ver_backpushButton_clicked()
         return;
     }
 
-    TubeRepository repository;
-    int64_t pastTubeId = repository.getPastTubeId(currentTubeId);
+    int64_t pastTubeId = getLinkedTubeId(currentTubeId, false);
 
     if (pastTubeId == -1) {
         qDebug() << "No previous version available";
@@ -2643,36 +2676,10 @@ void MainWindow::on_ver_backpushButton_clicked()
         return;
     }
 
-    Tube loadedTube;
-    if (!repository.loadTubeById(pastTubeId, loadedTube)) {
-        QMessageBox::critical(this, "Ошибка",
-                              "Не удалось загрузить предыдущую версию: " + repository.getLastError());
+    if (!showTubeVersion(pastTubeId)) {
         return;
     }
 
-
-    tube = loadedTube;
-    currentTubeId = pastTubeId;
-
-
-    DatabaseManager& db = DatabaseManager::getInstance();
-    QString query = QString("SELECT ver_id FROM tube WHERE id = %1").arg(pastTubeId);
-    QSqlQuery result = db.executeQuery(query);
-    if (result.next()) {
-        currentVersionId = result.value(0).toInt();
-    }
-
-
-    Tube::TubeConstructionResult meshResult = tube.buildMesh();
-    if (meshResult.success) {
-        tubeViewer->setTubeMesh(meshResult.mesh);
-        std::vector<Point3D> centersCurve = tube.getCentersCurve();
-        tubeViewer->updateCentersCurve(centersCurve);
-    }
-
-
-    updateVersionNavigationButtons();
-
     qDebug() << "Loaded previous version. Current tube_id:" << currentTubeId
              << "ver_id:" << currentVersionId;
 }
@@ -2686,8 +2693,7 @@ void MainWindow::on_ver_forvardpushButton_clicked()
         return;
     }
 
-    TubeRepository repository;
-    int64_t futureTubeId = repository.getFutureTubeId(currentTubeId);
+    int64_t futureTubeId = getLinkedTubeId(currentTubeId, true);
 
     if (futureTubeId == -1) {
         qDebug() << "No next version available";
@@ -2695,56 +2701,102 @@ void MainWindow::on_ver_forvardpushButton_clicked()
         return;
     }
 
-    Tube loadedTube;
-    if (!repository.loadTubeById(futureTubeId, loadedTube)) {
-        QMessageBox::critical(this, "Ошибка",
-                              "Не удалось загрузить следующую версию: " + repository.getLastError());
+    if (!showTubeVersion(futureTubeId)) {
         return;
     }
 
+    qDebug() << "Loaded next version. Current tube_id:" << currentTubeId
+             << "ver_id:" << currentVersionId;
+}
 
-    tube = loadedTube;
-    currentTubeId = futureTubeId;
+int64_t MainWindow::getLinkedTubeId(int64_t tubeId, bool future)
+{
+    // Связи закэшированной версии актуальны: кэш сбрасывается при их изменении
+    std::shared_ptr<const TubeVersionCache::Entry> cached = versionCache.peek(tubeId);
+    if (cached) {
+        return future ? cached->futureTubeId : cached->pastTubeId;
+    }
 
+    TubeRepository repository;
+    return future ? repository.getFutureTubeId(tubeId) : repository.getPastTubeId(tubeId);
+}
 
-    DatabaseManager& db = DatabaseManager::getInstance();
-    QString query = QString("SELECT ver_id FROM tube WHERE id = %1").arg(futureTubeId);
-    QSqlQuery result = db.executeQuery(query);
-    if (result.next()) {
-        currentVersionId = result.value(0).toInt();
+std::shared_ptr<const TubeVersionCache::Entry> MainWindow::loadTubeVersion(int64_t tubeId, QString& error)
+{
+    std::shared_ptr<const TubeVersionCache::Entry> cached = versionCache.get(tubeId);
+    if (cached) {
+        qDebug() << "Tube" << tubeId << "taken from version cache";
+        return cached;
     }
 
+    TubeRepository repository;
+    std::shared_ptr<TubeVersionCache::Entry> entry = std::make_shared<TubeVersionCache::Entry>();
+    if (!repository.loadTubeById(tubeId, entry->tube)) {
+        error = repository.getLastError();
+        return nullptr;
+    }
+
+    // ver_id уже прочитан загрузчиком
+    entry->verId = repository.getLastLoadedVerId();
+    entry->pastTubeId = repository.getPastTubeId(tubeId);
+    entry->futureTubeId = repository.getFutureTubeId(tubeId);
+    qDebug() << "Tube" << tubeId << "loaded in" << repository.getLastLoadTimeMs() << "ms";
 
-    Tube::TubeConstructionResult meshResult = tube.buildMesh();
+    Tube::TubeConstructionResult meshResult = entry->tube.buildMesh();
+    entry->meshValid = meshResult.success;
     if (meshResult.success) {
-        tubeViewer->setTubeMesh(meshResult.mesh);
+        entry->mesh = std::move(meshResult.mesh);
+    }
+
+    versionCache.put(tubeId, entry);
+    return entry;
+}
+
+bool MainWindow::showTubeVersion(int64_t tubeId)
+{
+    versionPrefetcher->recordNavigation(tubeId);
+
+    QString error;
+    std::shared_ptr<const TubeVersionCache::Entry> entry = loadTubeVersion(tubeId, error);
+    if (!entry) {
+        QMessageBox::critical(this, "Ошибка",
+                              "Не удалось загрузить версию трубки: " + error);
+        return false;
+    }
+
+    tube = entry->tube;
+    currentTubeId = tubeId;
+    // Запись кэша неизменяема - сохраняем ссылку на её трубку без копирования
+    currentTubeSnapshot = std::shared_ptr<const Tube>(entry, &entry->tube);
+    currentVersionId = entry->verId;
+
+    if (entry->meshValid) {
+        tubeViewer->setTubeMesh(entry->mesh);
         std::vector<Point3D> centersCurve = tube.getCentersCurve();
         tubeViewer->updateCentersCurve(centersCurve);
     }
 
-
     updateVersionNavigationButtons();
 
-    qDebug() << "Loaded next version. Current tube_id:" << currentTubeId
-             << "ver_id:" << currentVersionId;
+    // Запись версии уже в кэше; следующий шаг назад/вперёд, скорее всего, будет к соседней
+    versionPrefetcher->prefetchAround(tubeId);
+    return true;
 }
 
 void MainWindow::updateVersionNavigationButtons()
 {
-    if (currentTubeId == -1) {
+    // Цепочка версий ещё дописывается в фоне
+    if (currentTubeId == -1 || pendingSaveJobs > 0) {
         ui->ver_backpushButton->setEnabled(false);
         ui->ver_forvardpushButton->setEnabled(false);
         return;
     }
 
-    TubeRepository repository;
-
-
-    int64_t pastId = repository.getPastTubeId(currentTubeId);
+    int64_t pastId = getLinkedTubeId(currentTubeId, false);
     ui->ver_backpushButton->setEnabled(pastId != -1);
 
 
-    int64_t futureId = repository.getFutureTubeId(currentTubeId);
+    int64_t futureId = getLinkedTubeId(currentTubeId, true);
     ui->ver_forvardpushButton->setEnabled(futureId != -1);
 
     qDebug() << "Version navigation buttons updated. Past available:" << (pastId != -1)
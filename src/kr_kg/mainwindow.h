@@ -10,11 +10,16 @@
 #include "sectionframe.h"
 #include "tubeviewer.h"
 #include "deformationengine.h"
+#include "tubeversioncache.h"
 #include <QVector>
 #include <QUndoStack>
 #include <QShortcut>
 #include <qtextbrowser.h>
 
+class QThread;
+class TubePersistenceWorker;
+class TubeVersionPrefetcher;
+
 namespace Ui {
 class MainWindow;
 }
@@ -107,6 +112,9 @@ private slots:
     void on_ver_forvardpushButton_clicked();
     void updateVersionNavigationButtons();
 
+    void onTubeSaved(int jobId, qint64 tubeId, int verId, qint64 elapsedMs);
+    void onTubeSaveFailed(int jobId, int verId, const QString& error);
+
 private:
     Ui::MainWindow *ui;
     GridEditor *gridEditor;
@@ -129,6 +137,12 @@ private:
     const int GRID_SIZE_SMALL = 3;
     const int GRID_SIZE_MEDIUM = 7;
     const int GRID_SIZE_LARGE = 18;
+    // Каждая N-я версия трубки в БД хранится полным снимком, остальные - дельтами
+    const int VERSION_KEYFRAME_INTERVAL = 8;
+    static const size_t VERSION_CACHE_BUDGET_BYTES = 128 * 1024 * 1024;
+    // Соседние версии загружаются заранее на эту глубину в каждую сторону
+    const int VERSION_PREFETCH_DEPTH = 2;
+    static const size_t VERSION_PREFETCH_BUDGET_BYTES = 48 * 1024 * 1024;
     void updateSectionsColor(const QColor& color);
 
     void saveSectionToFile(const SectionFrame* frame, const QString& filepath);
@@ -164,10 +178,28 @@ private:
     std::vector<Point3D> originalCentersCurve;
 
     bool saveTubeToDatabase(const Tube& tube);
+    bool enqueueTubeSave(const Tube& tube, qint64 previousTubeId,
+                         std::shared_ptr<const Tube> previousTube = nullptr);
 
     Tube currentTube;
 
     int64_t currentTubeId = -1;
+    // Содержимое версии currentTubeId, загруженной навигацией по версиям: с ним сравнивается
+    // дельта при сохранении. После сохранения - nullptr, версию продолжает цепочка воркера
+    std::shared_ptr<const Tube> currentTubeSnapshot;
+
+    // Фоновое сохранение версий: пока есть незавершённые задачи,
+    // навигация по версиям и удаление будущих версий недоступны
+    QThread *persistenceThread = nullptr;
+    TubePersistenceWorker *persistenceWorker = nullptr;
+    int pendingSaveJobs = 0;
+
+    // Недавно просмотренные версии: навигация по ним не обращается к БД
+    TubeVersionCache versionCache{VERSION_CACHE_BUDGET_BYTES};
+    TubeVersionPrefetcher *versionPrefetcher = nullptr;
+    int64_t getLinkedTubeId(int64_t tubeId, bool future);
+    std::shared_ptr<const TubeVersionCache::Entry> loadTubeVersion(int64_t tubeId, QString& error);
+    bool showTubeVersion(int64_t tubeId);
 
 
 protected:
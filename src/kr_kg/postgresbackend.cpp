@@ -0,0 +1,375 @@
+#include "postgresbackend.h"
+
+QString PostgresBackend::getDriverName() const
+{
+    return "QPSQL";
+}
+
+void PostgresBackend::configureConnection(QSqlDatabase& db, const QString& host, int port,
+                                          const QString& dbname, const QString& user,
+                                          const QString& password) const
+{
+    db.setHostName(host);
+    db.setPort(port);
+    db.setDatabaseName(dbname);
+    db.setUserName(user);
+    db.setPassword(password);
+}
+
+QStringList PostgresBackend::getSessionStatements() const
+{
+    return QStringList();
+}
+
+QStringList PostgresBackend::getSchemaStatements() const
+{
+    return QStringList();
+}
+
+std::vector<StorageBackend::SchemaMigration> PostgresBackend::getMigrations() const
+{
+    std::vector<SchemaMigration> migrations;
+
+    // БД, созданные скриптом до появления дельта-версий и упакованных контуров
+    migrations.push_back({
+        1,
+        "delta versions and packed contours",
+        {
+            "ALTER TABLE tube ADD COLUMN IF NOT EXISTS storage_kind smallint NOT NULL DEFAULT 0",
+            "ALTER TABLE tube ADD COLUMN IF NOT EXISTS base_tube_id bigint "
+            "REFERENCES tube(id) ON DELETE CASCADE",
+            "ALTER TABLE tube DROP CONSTRAINT IF EXISTS delta_has_base",
+            "ALTER TABLE tube ADD CONSTRAINT delta_has_base "
+            "CHECK (storage_kind = 0 OR base_tube_id IS NOT NULL)",
+            "CREATE INDEX IF NOT EXISTS idx_tube_base ON tube(base_tube_id)",
+            "CREATE TABLE IF NOT EXISTS point_delta ("
+            "    id bigserial PRIMARY KEY,"
+            "    tube_id bigint NOT NULL REFERENCES tube(id) ON DELETE CASCADE,"
+            "    section_index integer NOT NULL,"
+            "    index_in_section integer NOT NULL,"
+            "    x real NOT NULL,"
+            "    y real NOT NULL,"
+            "    z real NOT NULL,"
+            "    CONSTRAINT unique_point_delta UNIQUE (tube_id, section_index, index_in_section)"
+            ")",
+            "ALTER TABLE section ADD COLUMN IF NOT EXISTS contour bytea"
+        }
+    });
+
+    // Загрузчик читает точки и рёбра по (родитель, индекс): уникальные ограничения
+    // становятся покрывающими (index-only scan без обращения к таблице),
+    // одностолбцовые и дублирующие их составные индексы удаляются
+    migrations.push_back({
+        2,
+        "covering indexes for the load path",
+        {
+            "ALTER TABLE section DROP CONSTRAINT IF EXISTS unique_section_in_tube",
+            "ALTER TABLE section ADD CONSTRAINT unique_section_in_tube "
+            "UNIQUE (tube_id, \"index\") INCLUDE (id)",
+            "DROP INDEX IF EXISTS idx_section_tube",
+            "DROP INDEX IF EXISTS idx_section_tube_index",
+
+            "ALTER TABLE segment DROP CONSTRAINT IF EXISTS unique_segment_in_tube",
+            "ALTER TABLE segment ADD CONSTRAINT unique_segment_in_tube "
+            "UNIQUE (tube_id, \"index\") INCLUDE (id)",
+            "DROP INDEX IF EXISTS idx_segment_tube",
+            "DROP INDEX IF EXISTS idx_segment_tube_index",
+
+            "ALTER TABLE point DROP CONSTRAINT IF EXISTS unique_point_in_section",
+            "ALTER TABLE point ADD CONSTRAINT unique_point_in_section "
+            "UNIQUE (section_id, index_in_section) INCLUDE (x, y, z)",
+            "DROP INDEX IF EXISTS idx_point_section",
+            "DROP INDEX IF EXISTS idx_point_section_index",
+
+            "ALTER TABLE edge DROP CONSTRAINT IF EXISTS unique_edge_in_segment",
+            "ALTER TABLE edge ADD CONSTRAINT unique_edge_in_segment "
+            "UNIQUE (segment_id, \"index\") INCLUDE (start_point_id, end_point_id, beg_sz)",
+            "DROP INDEX IF EXISTS idx_edge_segment",
+            "DROP INDEX IF EXISTS idx_edge_segment_index"
+        }
+    });
+
+    // Центр сечения как вырожденный box по (x, y): GiST из ядра, без расширений;
+    // z отсекается условием по диапазону
+    migrations.push_back({
+        3,
+        "spatial index on section centers",
+        {
+            "CREATE INDEX IF NOT EXISTS idx_section_center ON section "
+            "USING gist (box(point(x_cen, y_cen), point(x_cen, y_cen)))"
+        }
+    });
+
+    // Пересчёт длины трубки триггерами уровня оператора. Единственный источник этих
+    // объектов: data/DBMaker.sql их не создаёт и отмечает применёнными только миграции 1-3.
+    // В старых БД заменяет построчные триггеры, которые пересчитывали длину на каждую
+    // строку и молча игнорировали отложенный пересчёт (tube.defer_length_calc)
+    migrations.push_back({
+        4,
+        "statement-level tube length triggers",
+        {
+            // id трубок, ожидающих пересчёта до конца транзакции
+            "create table if not exists tube_length_pending ( "
+            "    tube_id bigint primary key "
+            ")",
+
+            // Сумма max(beg_sz) по сегментам каждой трубки из набора
+            "create or replace function recalculate_tube_lengths(tube_ids bigint[])\n"
+            "returns void as $$\n"
+            "begin\n"
+            "    update tube t\n"
+            "    set len = l.new_length\n"
+            "    from (\n"
+            "        select tid.id as tube_id, coalesce(sum(seg.max_edge_length), 0) as new_length\n"
+            "        from unnest(tube_ids) as tid(id)\n"
+            "        left join (\n"
+            "            select s.tube_id, max(e.beg_sz) as max_edge_length\n"
+            "            from segment s\n"
+            "            left join edge e on e.segment_id = s.id\n"
+            "            where s.tube_id = any(tube_ids)\n"
+            "            group by s.id, s.tube_id\n"
+            "        ) as seg on seg.tube_id = tid.id\n"
+            "        group by tid.id\n"
+            "    ) as l\n"
+            "    where t.id = l.tube_id\n"
+            "      and t.len is distinct from l.new_length;\n"
+            "end;\n"
+            "$$ language plpgsql",
+
+            // Пересчитать сразу или, если в транзакции выполнено
+            // set local tube.defer_length_calc = 'on', отложить до commit
+            "create or replace function queue_tube_length_update(tube_ids bigint[])\n"
+            "returns void as $$\n"
+            "begin\n"
+            "    if tube_ids is null or cardinality(tube_ids) = 0 then\n"
+            "        return;\n"
+            "    end if;\n"
+            "\n"
+            "    if coalesce(current_setting('tube.defer_length_calc', true), 'off') = 'on' then\n"
+            "        insert into tube_length_pending (tube_id)\n"
+            "        select distinct unnest(tube_ids)\n"
+            "        on conflict do nothing;\n"
+            "    else\n"
+            "        perform recalculate_tube_lengths(tube_ids);\n"
+            "    end if;\n"
+            "end;\n"
+            "$$ language plpgsql",
+
+            // Срабатывает при commit: пересчитывает все накопленные трубки за один раз
+            "create or replace function flush_tube_length_pending()\n"
+            "returns trigger as $$\n"
+            "declare\n"
+            "    pending_ids bigint[];\n"
+            "begin\n"
+            "    with flushed as (\n"
+            "        delete from tube_length_pending returning tube_id\n"
+            "    )\n"
+            "    select array_agg(tube_id) into pending_ids from flushed;\n"
+            "\n"
+            "    if pending_ids is not null then\n"
+            "        perform recalculate_tube_lengths(pending_ids);\n"
+            "    end if;\n"
+            "\n"
+            "    return null;\n"
+            "end;\n"
+            "$$ language plpgsql",
+
+            // UPDATE сегмента меняет длину только при смене трубки
+            "create or replace function calculate_tube_length_on_segment()\n"
+            "returns trigger as $$\n"
+            "declare\n"
+            "    tube_ids bigint[];\n"
+            "begin\n"
+            "    if tg_op = 'INSERT' then\n"
+            "        select array_agg(distinct tube_id) into tube_ids from new_rows;\n"
+            "    elsif tg_op = 'DELETE' then\n"
+            "        select array_agg(distinct tube_id) into tube_ids from old_rows;\n"
+            "    else\n"
+            "        select array_agg(distinct x.tube_id) into tube_ids\n"
+            "        from (\n"
+            "            select o.tube_id from old_rows o join new_rows n on n.id = o.id\n"
+            "            where n.tube_id is distinct from o.tube_id\n"
+            "            union\n"
+            "            select n.tube_id from old_rows o join new_rows n on n.id = o.id\n"
+            "            where n.tube_id is distinct from o.tube_id\n"
+            "        ) as x;\n"
+            "    end if;\n"
+            "\n"
+            "    perform queue_tube_length_update(tube_ids);\n"
+            "    return null;\n"
+            "end;\n"
+            "$$ language plpgsql",
+
+            // UPDATE ребра: связи версий (future/past) длину не меняют
+            "create or replace function calculate_tube_length_on_edge()\n"
+            "returns trigger as $$\n"
+            "declare\n"
+            "    tube_ids bigint[];\n"
+            "begin\n"
+            "    if tg_op = 'INSERT' then\n"
+            "        select array_agg(distinct s.tube_id) into tube_ids\n"
+            "        from new_rows e join segment s on s.id = e.segment_id;\n"
+            "    elsif tg_op = 'DELETE' then\n"
+            "        select array_agg(distinct s.tube_id) into tube_ids\n"
+            "        from old_rows e join segment s on s.id = e.segment_id;\n"
+            "    else\n"
+            "        select array_agg(distinct s.tube_id) into tube_ids\n"
+            "        from old_rows o\n"
+            "        join new_rows n on n.id = o.id\n"
+            "        join segment s on s.id in (o.segment_id, n.segment_id)\n"
+            "        where n.beg_sz is distinct from o.beg_sz\n"
+            "           or n.segment_id is distinct from o.segment_id;\n"
+            "    end if;\n"
+            "\n"
+            "    perform queue_tube_length_update(tube_ids);\n"
+            "    return null;\n"
+            "end;\n"
+            "$$ language plpgsql",
+
+            // По триггеру на событие: таблицы переходов не допускаются
+            // в триггерах на несколько событий
+            "drop trigger if exists update_tube_length_on_segment on segment",
+            "drop trigger if exists update_tube_length_on_segment_insert on segment",
+            "drop trigger if exists update_tube_length_on_segment_update on segment",
+            "drop trigger if exists update_tube_length_on_segment_delete on segment",
+
+            "create trigger update_tube_length_on_segment_insert "
+            "after insert on segment "
+            "referencing new table as new_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_segment()",
+
+            "create trigger update_tube_length_on_segment_update "
+            "after update on segment "
+            "referencing old table as old_rows new table as new_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_segment()",
+
+            "create trigger update_tube_length_on_segment_delete "
+            "after delete on segment "
+            "referencing old table as old_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_segment()",
+
+            "drop trigger if exists update_tube_length_on_edge on edge",
+            "drop trigger if exists update_tube_length_on_edge_insert on edge",
+            "drop trigger if exists update_tube_length_on_edge_update on edge",
+            "drop trigger if exists update_tube_length_on_edge_delete on edge",
+
+            "create trigger update_tube_length_on_edge_insert "
+            "after insert on edge "
+            "referencing new table as new_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_edge()",
+
+            "create trigger update_tube_length_on_edge_update "
+            "after update on edge "
+            "referencing old table as old_rows new table as new_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_edge()",
+
+            "create trigger update_tube_length_on_edge_delete "
+            "after delete on edge "
+            "referencing old table as old_rows "
+            "for each statement "
+            "execute function calculate_tube_length_on_edge()",
+
+            "drop trigger if exists flush_tube_length_pending on tube_length_pending",
+            "create constraint trigger flush_tube_length_pending "
+            "after insert on tube_length_pending "
+            "deferrable initially deferred "
+            "for each row "
+            "execute function flush_tube_length_pending()"
+        }
+    });
+
+    // У дельта-версий нет своих строк section, а центры сечений у них свои: пространственные
+    // запросы читают их из delta_section_center (индекс - как idx_section_center).
+    // section_id - строка базового снимка, которую использует версия. Уже сохранённые
+    // дельты заполняются так же, как их восстанавливает загрузка: точки снимка,
+    // поверх них самые свежие значения из point_delta по цепочке base_tube_id
+    migrations.push_back({
+        5,
+        "section centers of delta versions",
+        {
+            "CREATE TABLE IF NOT EXISTS delta_section_center ("
+            "    tube_id bigint NOT NULL REFERENCES tube(id) ON DELETE CASCADE,"
+            "    section_id bigint NOT NULL REFERENCES section(id) ON DELETE CASCADE,"
+            "    \"index\" integer NOT NULL,"
+            "    x_cen real NOT NULL,"
+            "    y_cen real NOT NULL,"
+            "    z_cen real NOT NULL,"
+            "    PRIMARY KEY (tube_id, \"index\")"
+            ")",
+            "CREATE INDEX IF NOT EXISTS idx_delta_section_center ON delta_section_center "
+            "USING gist (box(point(x_cen, y_cen), point(x_cen, y_cen)))",
+
+            "INSERT INTO delta_section_center (tube_id, section_id, \"index\", x_cen, y_cen, z_cen) "
+            "WITH RECURSIVE chain AS ( "
+            "  SELECT id AS version_id, id, base_tube_id, storage_kind, 0 AS depth "
+            "  FROM tube WHERE storage_kind = 1 "
+            "  UNION ALL "
+            "  SELECT c.version_id, t.id, t.base_tube_id, t.storage_kind, c.depth + 1 "
+            "  FROM tube t JOIN chain c ON t.id = c.base_tube_id "
+            "  WHERE c.storage_kind = 1 "
+            "), delta_points AS ( "
+            "  SELECT version_id, section_index, index_in_section, x, y, z FROM ( "
+            "    SELECT c.version_id, d.section_index, d.index_in_section, d.x, d.y, d.z, "
+            "           row_number() OVER (PARTITION BY c.version_id, d.section_index, d.index_in_section "
+            "                              ORDER BY c.depth) AS rn "
+            "    FROM chain c JOIN point_delta d ON d.tube_id = c.id "
+            "    WHERE c.storage_kind = 1 "
+            "  ) AS ranked WHERE rn = 1 "
+            ") "
+            "SELECT c.version_id, s.id, s.\"index\", "
+            "       AVG(COALESCE(d.x, p.x)), AVG(COALESCE(d.y, p.y)), AVG(COALESCE(d.z, p.z)) "
+            "FROM chain c "
+            "JOIN section s ON s.tube_id = c.id "
+            "JOIN point p ON p.section_id = s.id AND p.index_in_section IS NOT NULL "
+            "LEFT JOIN delta_points d ON d.version_id = c.version_id "
+            " AND d.section_index = s.\"index\" AND d.index_in_section = p.index_in_section "
+            "WHERE c.storage_kind = 0 "
+            "GROUP BY c.version_id, s.id, s.\"index\" "
+            "ON CONFLICT DO NOTHING"
+        }
+    });
+
+    return migrations;
+}
+
+QString PostgresBackend::tableExistsQuery(const QString& table) const
+{
+    return QString(
+               "SELECT EXISTS ("
+               "   SELECT FROM information_schema.tables "
+               "   WHERE table_schema = 'public' "
+               "   AND table_name = '%1'"
+               ")").arg(table);
+}
+
+QString PostgresBackend::lastInsertIdQuery() const
+{
+    return "SELECT lastval()";
+}
+
+QString PostgresBackend::sequenceReservationQuery(const QString& table, int count) const
+{
+    return QString(
+               "SELECT nextval(pg_get_serial_sequence('%1', 'id')) "
+               "FROM generate_series(1, %2)"
+               ).arg(table).arg(count);
+}
+
+QString PostgresBackend::idListPredicate(const QString& column, const std::vector<int64_t>& ids) const
+{
+    QStringList items;
+    for (int64_t id : ids) {
+        items.append(QString::number(id));
+    }
+    return QString("%1 = ANY('{%2}'::bigint[])").arg(column, items.join(','));
+}
+
+QString PostgresBackend::blobLiteral(const QByteArray& data) const
+{
+    return QString("decode('%1', 'hex')").arg(QString::fromLatin1(data.toHex()));
+}
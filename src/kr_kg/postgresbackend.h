@@ -0,0 +1,33 @@
+#ifndef POSTGRESBACKEND_H
+#define POSTGRESBACKEND_H
+
+#include "storagebackend.h"
+
+// PostgreSQL через QPSQL. Схема создаётся скриптом data/DBMaker.sql
+class PostgresBackend : public StorageBackend
+{
+public:
+    QString getDriverName() const override;
+
+    void configureConnection(QSqlDatabase& db, const QString& host, int port,
+                             const QString& dbname, const QString& user,
+                             const QString& password) const override;
+
+    QStringList getSessionStatements() const override;
+    QStringList getSchemaStatements() const override;
+    std::vector<SchemaMigration> getMigrations() const override;
+
+    QString tableExistsQuery(const QString& table) const override;
+    QString lastInsertIdQuery() const override;
+    QString sequenceReservationQuery(const QString& table, int count) const override;
+
+    QString idListPredicate(const QString& column, const std::vector<int64_t>& ids) const override;
+    QString blobLiteral(const QByteArray& data) const override;
+
+    bool supportsArrayOperations() const override { return true; }
+    bool supportsDeferredLengthUpdates() const override { return true; }
+    bool maintainsTubeLength() const override { return true; }
+    bool supportsSpatialIndex() const override { return true; }
+};
+
+#endif // POSTGRESBACKEND_H
@@ -1,4 +1,5 @@
 #include "section.h"
+#include "contoursweep.h"
 #include <cmath>
 #include <algorithm>
 #include <numeric>
@@ -104,6 +105,23 @@ std::vector<Edge> Section::getImplicitEdges() const
     return edges;
 }
 
+std::vector<Edge> Section::getContourEdges() const
+{
+    std::vector<Edge> edges;
+
+    if (points.size() < 2) {
+        return edges;
+    }
+
+    edges.reserve(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        size_t nextIndex = (i + 1) % points.size();
+        edges.emplace_back(points[i], points[nextIndex], static_cast<int>(i + 1));
+    }
+
+    return edges;
+}
+
 Point3D Section::getCenter() const
 {
     if (points.empty()) {
@@ -225,16 +243,7 @@ bool Section::hasDuplicatePoints() const
 
 bool Section::hasIntersectingEdges() const
 {
-    std::vector<Edge> implicitEdges = getImplicitEdges();
-
-    for (size_t i = 0; i < implicitEdges.size(); ++i) {
-        for (size_t j = i + 1; j < implicitEdges.size(); ++j) {
-            if (Edge::doIntersect(implicitEdges[i], implicitEdges[j])) {
-                return true;
-            }
-        }
-    }
-    return false;
+    return ContourSweep::hasIntersectingEdges(getImplicitEdges());
 }
 
 void Section::translate(const Point3D& offset)
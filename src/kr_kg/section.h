@@ -30,6 +30,8 @@ public:
 
 
     std::vector<Edge> getImplicitEdges() const;
+    // Рёбра контура с координатами точек (getImplicitEdges хранит только номера точек)
+    std::vector<Edge> getContourEdges() const;
 
 
     Point3D getCenter() const;
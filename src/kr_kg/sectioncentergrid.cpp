@@ -0,0 +1,147 @@
+#include "sectioncentergrid.h"
+#include <algorithm>
+#include <cmath>
+
+SectionCenterGrid::SectionCenterGrid()
+    : cellSize(1.0f)
+{
+}
+
+void SectionCenterGrid::build(std::vector<Entry> centers)
+{
+    clear();
+    entries = std::move(centers);
+
+    if (entries.empty()) {
+        return;
+    }
+
+    Point3D minCorner = entries.front().center;
+    Point3D maxCorner = entries.front().center;
+    for (const Entry& entry : entries) {
+        minCorner.x = std::min(minCorner.x, entry.center.x);
+        minCorner.y = std::min(minCorner.y, entry.center.y);
+        minCorner.z = std::min(minCorner.z, entry.center.z);
+        maxCorner.x = std::max(maxCorner.x, entry.center.x);
+        maxCorner.y = std::max(maxCorner.y, entry.center.y);
+        maxCorner.z = std::max(maxCorner.z, entry.center.z);
+    }
+
+    // Наибольший охват, делённый на корень кубический из числа центров
+    const Point3D extent = maxCorner - minCorner;
+    const float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    const float cellsPerAxis = std::max(1.0f, std::cbrt(static_cast<float>(entries.size())));
+    origin = minCorner;
+    cellSize = maxExtent > 0.0f ? maxExtent / cellsPerAxis : 1.0f;
+
+    cells.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        cells[cellOf(entries[i].center)].push_back(i);
+        centerlines[entries[i].tubeId].push_back(i);
+    }
+
+    for (auto& centerline : centerlines) {
+        std::sort(centerline.second.begin(), centerline.second.end(),
+                  [this](size_t a, size_t b) {
+                      return entries[a].sectionIndex < entries[b].sectionIndex;
+                  });
+    }
+}
+
+void SectionCenterGrid::clear()
+{
+    entries.clear();
+    cells.clear();
+    centerlines.clear();
+    origin = Point3D();
+    cellSize = 1.0f;
+}
+
+bool SectionCenterGrid::isEmpty() const
+{
+    return entries.empty();
+}
+
+size_t SectionCenterGrid::getEntryCount() const
+{
+    return entries.size();
+}
+
+const SectionCenterGrid::Entry& SectionCenterGrid::getEntry(size_t position) const
+{
+    return entries[position];
+}
+
+std::vector<size_t> SectionCenterGrid::queryBox(const Point3D& minCorner, const Point3D& maxCorner) const
+{
+    std::vector<size_t> result;
+    if (entries.empty()) {
+        return result;
+    }
+
+    const CellKey first = cellOf(minCorner);
+    const CellKey last = cellOf(maxCorner);
+    const int64_t cellCount = (static_cast<int64_t>(last.x) - first.x + 1)
+                              * (static_cast<int64_t>(last.y) - first.y + 1)
+                              * (static_cast<int64_t>(last.z) - first.z + 1);
+
+    // Область больше всей сетки - дешевле проверить все центры
+    if (cellCount <= 0 || cellCount > static_cast<int64_t>(cells.size())) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (isInside(entries[i].center, minCorner, maxCorner)) {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    for (int x = first.x; x <= last.x; ++x) {
+        for (int y = first.y; y <= last.y; ++y) {
+            for (int z = first.z; z <= last.z; ++z) {
+                auto cell = cells.find(CellKey{x, y, z});
+                if (cell == cells.end()) {
+                    continue;
+                }
+                for (size_t position : cell->second) {
+                    if (isInside(entries[position].center, minCorner, maxCorner)) {
+                        result.push_back(position);
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+const std::vector<size_t>& SectionCenterGrid::getCenterline(int64_t tubeId) const
+{
+    static const std::vector<size_t> empty;
+    auto centerline = centerlines.find(tubeId);
+    return centerline != centerlines.end() ? centerline->second : empty;
+}
+
+size_t SectionCenterGrid::CellKeyHash::operator()(const CellKey& key) const
+{
+    return static_cast<size_t>(key.x) * 73856093u
+           ^ static_cast<size_t>(key.y) * 19349663u
+           ^ static_cast<size_t>(key.z) * 83492791u;
+}
+
+SectionCenterGrid::CellKey SectionCenterGrid::cellOf(const Point3D& point) const
+{
+    // Ограничение, чтобы границы огромной области запроса не переполняли int
+    const float limit = 1.0e6f;
+    auto axis = [this, limit](float value, float start) {
+        return static_cast<int>(std::max(-limit, std::min(limit, std::floor((value - start) / cellSize))));
+    };
+    return CellKey{axis(point.x, origin.x), axis(point.y, origin.y), axis(point.z, origin.z)};
+}
+
+bool SectionCenterGrid::isInside(const Point3D& point, const Point3D& minCorner, const Point3D& maxCorner)
+{
+    return point.x >= minCorner.x && point.x <= maxCorner.x
+           && point.y >= minCorner.y && point.y <= maxCorner.y
+           && point.z >= minCorner.z && point.z <= maxCorner.z;
+}
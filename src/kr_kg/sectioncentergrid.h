@@ -0,0 +1,64 @@
+#ifndef SECTIONCENTERGRID_H
+#define SECTIONCENTERGRID_H
+
+#include "point3d.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Равномерная сетка по центрам сечений всех трубок - замена пространственного
+// индекса СУБД, когда его нет (SQLite). Строится из одного чтения таблицы section.
+// Размер ячейки подбирается по охвату и числу центров (в среднем ~1 центр на ячейку).
+class SectionCenterGrid
+{
+public:
+    struct Entry {
+        int64_t sectionId;
+        int64_t tubeId;
+        int sectionIndex;
+        Point3D center;
+    };
+
+    SectionCenterGrid();
+
+    void build(std::vector<Entry> centers);
+    void clear();
+
+    bool isEmpty() const;
+    size_t getEntryCount() const;
+    const Entry& getEntry(size_t position) const;
+
+    // Позиции центров внутри параллелепипеда (границы включаются)
+    std::vector<size_t> queryBox(const Point3D& minCorner, const Point3D& maxCorner) const;
+
+    // Центры сечений трубки по возрастанию индекса сечения
+    const std::vector<size_t>& getCenterline(int64_t tubeId) const;
+
+private:
+    struct CellKey {
+        int x;
+        int y;
+        int z;
+
+        bool operator==(const CellKey& other) const
+        {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+    struct CellKeyHash {
+        size_t operator()(const CellKey& key) const;
+    };
+
+    CellKey cellOf(const Point3D& point) const;
+    static bool isInside(const Point3D& point, const Point3D& minCorner, const Point3D& maxCorner);
+
+    std::vector<Entry> entries;
+    std::unordered_map<CellKey, std::vector<size_t>, CellKeyHash> cells;
+    std::unordered_map<int64_t, std::vector<size_t>> centerlines;
+    Point3D origin;
+    float cellSize;
+};
+
+#endif // SECTIONCENTERGRID_H
@@ -1,4 +1,5 @@
 #include "segment.h"
+#include "contoursweep.h"
 #include <cmath>
 #include <algorithm>
 #include <set>
@@ -194,12 +195,17 @@ bool Segment::attemptSegmentConstruction(Section& section1, Section& section2,
     Section* smallSection = &section1;
     Section* largeSection = &section2;
 
-    qDebug() << "attemptSegmentConstruction: Step 2 - Scaling sections until no intersection";
-    if (!scaleSectionsUntilNoIntersection(*smallSection, *largeSection)) {
-        qDebug() << "attemptSegmentConstruction: ERROR - Failed to eliminate intersections by scaling";
+    // Полярные углы точек не зависят от масштаба сечения относительно его центра, поэтому
+    // рёбра строятся по настоящим контурам. Проверяется только, что меньший контур,
+    // сжатый до MIN_SECTION_SCALE, отделяется от большего: иначе больший контур проходит
+    // у самого центра и веер рёбер из центра не строится (пробуется обратный порядок)
+    qDebug() << "attemptSegmentConstruction: Step 2 - Checking contours at minimal scale";
+    Section minimalSection = *smallSection;
+    minimalSection.scale(MIN_SECTION_SCALE);
+    if (doSectionsIntersect(minimalSection, *largeSection)) {
+        qDebug() << "attemptSegmentConstruction: ERROR - Contours intersect at minimal scale" << MIN_SECTION_SCALE;
         return false;
     }
-    qDebug() << "attemptSegmentConstruction: Successfully eliminated intersections";
 
      
     qDebug() << "attemptSegmentConstruction: Step 3 - Building edges using polar method";
@@ -240,52 +246,9 @@ bool Segment::attemptSegmentConstruction(Section& section1, Section& section2,
     return true;
 }
 
-bool Segment::scaleSectionsUntilNoIntersection(Section& smallSection, Section& largeSection)
-{
-    qDebug() << "scaleSectionsUntilNoIntersection: Starting intersection elimination process";
-
-    const int MAX_ITERATIONS = 100;
-    const float SCALE_FACTOR = 0.95f;
-    const float MIN_SCALE = 0.1f;
-
-    float currentScale = 1.0f;
-
-    for (int iteration = 0; iteration < MAX_ITERATIONS; ++iteration) {
-        if (!doSectionsIntersect(smallSection, largeSection)) {
-            qDebug() << "scaleSectionsUntilNoIntersection: SUCCESS - No intersections after" << iteration << "iterations, scale:" << currentScale;
-            return true;
-        }
-
-        currentScale *= SCALE_FACTOR;
-        if (currentScale < MIN_SCALE) {
-            qDebug() << "scaleSectionsUntilNoIntersection: ERROR - Scale too small:" << currentScale;
-            return false;
-        }
-
-        smallSection.scale(SCALE_FACTOR);
-
-        if (iteration % 20 == 0) {
-            qDebug() << "scaleSectionsUntilNoIntersection: Iteration" << iteration << ", current scale:" << currentScale;
-        }
-    }
-
-    qDebug() << "scaleSectionsUntilNoIntersection: ERROR - Max iterations reached without eliminating intersections";
-    return false;
-}
-
 bool Segment::doSectionsIntersect(const Section& section1, const Section& section2) const
 {
-    std::vector<Edge> edges1 = section1.getImplicitEdges();
-    std::vector<Edge> edges2 = section2.getImplicitEdges();
-
-    for (const auto& edge1 : edges1) {
-        for (const auto& edge2 : edges2) {
-            if (Edge::doIntersect(edge1, edge2)) {
-                return true;
-            }
-        }
-    }
-    return false;  
+    return ContourSweep::edgesIntersect(section1.getContourEdges(), section2.getContourEdges());
 }
 
 bool Segment::buildEdgesUsingPolarMethod(const Section& section1, const Section& section2,
@@ -57,6 +57,9 @@ public:
 
     static bool canConnect(const Section& section1, const Section& section2);
 
+    // Масштаб, до которого сжимается меньший контур при проверке его отделимости от большего
+    static constexpr float MIN_SECTION_SCALE = 0.1f;
+
     ~Segment() = default;
 
 private:
@@ -81,7 +84,6 @@ private:
                                     int section1Index, int section2Index,
                                     float originalZ1, float originalZ2);
 
-    bool scaleSectionsUntilNoIntersection(Section& smallSection, Section& largeSection);
     bool doSectionsIntersect(const Section& section1, const Section& section2) const;
 
     bool buildEdgesUsingPolarMethod(const Section& section1, const Section& section2,
@@ -0,0 +1,167 @@
+#include "sqlitebackend.h"
+
+QString SqliteBackend::getDriverName() const
+{
+    return "QSQLITE";
+}
+
+void SqliteBackend::configureConnection(QSqlDatabase& db, const QString& host, int port,
+                                        const QString& dbname, const QString& user,
+                                        const QString& password) const
+{
+    Q_UNUSED(host);
+    Q_UNUSED(port);
+    Q_UNUSED(user);
+    Q_UNUSED(password);
+
+    db.setDatabaseName(dbname);
+    // Ожидание блокировки вместо немедленной ошибки SQLITE_BUSY при работе из пула потоков
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+}
+
+QStringList SqliteBackend::getSessionStatements() const
+{
+    // WAL: читатели не блокируют запись, fsync только на контрольных точках
+    return {
+        "PRAGMA journal_mode = WAL",
+        "PRAGMA synchronous = NORMAL",
+        "PRAGMA foreign_keys = ON",
+        "PRAGMA temp_store = MEMORY",
+        "PRAGMA cache_size = -32000"
+    };
+}
+
+QStringList SqliteBackend::getSchemaStatements() const
+{
+    // Та же структура, что в data/DBMaker.sql; bigserial -> autoincrement (id не переиспользуются)
+    return {
+        "CREATE TABLE IF NOT EXISTS tube ("
+        "    id integer primary key autoincrement,"
+        "    ver_id integer not null,"
+        "    len real not null,"
+        "    future_tube_id bigint references tube(id) on delete set null,"
+        "    past_tube_id bigint references tube(id) on delete set null,"
+        "    storage_kind smallint not null default 0,"
+        "    base_tube_id bigint references tube(id) on delete cascade,"
+        "    constraint delta_has_base check (storage_kind = 0 or base_tube_id is not null)"
+        ")",
+        "CREATE INDEX IF NOT EXISTS idx_tube_ver_id ON tube(ver_id)",
+        "CREATE INDEX IF NOT EXISTS idx_tube_future ON tube(future_tube_id)",
+        "CREATE INDEX IF NOT EXISTS idx_tube_past ON tube(past_tube_id)",
+        "CREATE INDEX IF NOT EXISTS idx_tube_base ON tube(base_tube_id)",
+
+        "CREATE TABLE IF NOT EXISTS section ("
+        "    id integer primary key autoincrement,"
+        "    tube_id bigint not null references tube(id) on delete cascade,"
+        "    ver_id integer not null,"
+        "    \"index\" integer not null,"
+        "    x_cen real not null,"
+        "    y_cen real not null,"
+        "    z_cen real not null,"
+        "    future_section_id bigint references section(id) on delete set null,"
+        "    past_section_id bigint references section(id) on delete set null,"
+        "    contour blob,"
+        "    constraint unique_section_in_tube unique (tube_id, \"index\")"
+        ")",
+        "CREATE INDEX IF NOT EXISTS idx_section_ver_id ON section(ver_id)",
+        "CREATE INDEX IF NOT EXISTS idx_section_future ON section(future_section_id)",
+        "CREATE INDEX IF NOT EXISTS idx_section_past ON section(past_section_id)",
+
+        "CREATE TABLE IF NOT EXISTS segment ("
+        "    id integer primary key autoincrement,"
+        "    tube_id bigint not null references tube(id) on delete cascade,"
+        "    ver_id integer not null,"
+        "    \"index\" integer not null,"
+        "    future_segment_id bigint references segment(id) on delete set null,"
+        "    past_segment_id bigint references segment(id) on delete set null,"
+        "    constraint unique_segment_in_tube unique (tube_id, \"index\")"
+        ")",
+        "CREATE INDEX IF NOT EXISTS idx_segment_ver_id ON segment(ver_id)",
+        "CREATE INDEX IF NOT EXISTS idx_segment_future ON segment(future_segment_id)",
+        "CREATE INDEX IF NOT EXISTS idx_segment_past ON segment(past_segment_id)",
+
+        "CREATE TABLE IF NOT EXISTS point ("
+        "    id integer primary key autoincrement,"
+        "    section_id bigint references section(id) on delete cascade,"
+        "    ver_id integer not null,"
+        "    index_in_section integer,"
+        "    x real not null,"
+        "    y real not null,"
+        "    z real not null,"
+        "    future_point_id bigint references point(id) on delete set null,"
+        "    past_point_id bigint references point(id) on delete set null,"
+        "    constraint unique_point_in_section unique (section_id, index_in_section)"
+        ")",
+        "CREATE INDEX IF NOT EXISTS idx_point_ver_id ON point(ver_id)",
+        "CREATE INDEX IF NOT EXISTS idx_point_future ON point(future_point_id)",
+        "CREATE INDEX IF NOT EXISTS idx_point_past ON point(past_point_id)",
+
+        "CREATE TABLE IF NOT EXISTS edge ("
+        "    id integer primary key autoincrement,"
+        "    segment_id bigint not null references segment(id) on delete cascade,"
+        "    ver_id integer not null,"
+        "    \"index\" integer not null,"
+        "    start_point_id bigint not null references point(id) on delete cascade,"
+        "    end_point_id bigint not null references point(id) on delete cascade,"
+        "    beg_sz real not null,"
+        "    future_edge_id bigint references edge(id) on delete set null,"
+        "    past_edge_id bigint references edge(id) on delete set null,"
+        "    constraint unique_edge_in_segment unique (segment_id, \"index\"),"
+        "    constraint different_points check (start_point_id != end_point_id)"
+        ")",
+        "CREATE INDEX IF NOT EXISTS idx_edge_ver_id ON edge(ver_id)",
+        "CREATE INDEX IF NOT EXISTS idx_edge_start_point ON edge(start_point_id)",
+        "CREATE INDEX IF NOT EXISTS idx_edge_end_point ON edge(end_point_id)",
+        "CREATE INDEX IF NOT EXISTS idx_edge_future ON edge(future_edge_id)",
+        "CREATE INDEX IF NOT EXISTS idx_edge_past ON edge(past_edge_id)",
+
+        "CREATE TABLE IF NOT EXISTS point_delta ("
+        "    id integer primary key autoincrement,"
+        "    tube_id bigint not null references tube(id) on delete cascade,"
+        "    section_index integer not null,"
+        "    index_in_section integer not null,"
+        "    x real not null,"
+        "    y real not null,"
+        "    z real not null,"
+        "    constraint unique_point_delta unique (tube_id, section_index, index_in_section)"
+        ")"
+    };
+}
+
+std::vector<StorageBackend::SchemaMigration> SqliteBackend::getMigrations() const
+{
+    // Схема создаётся getSchemaStatements сразу в актуальном виде
+    return {};
+}
+
+QString SqliteBackend::tableExistsQuery(const QString& table) const
+{
+    return QString("SELECT EXISTS (SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = '%1')")
+        .arg(table);
+}
+
+QString SqliteBackend::lastInsertIdQuery() const
+{
+    return "SELECT last_insert_rowid()";
+}
+
+QString SqliteBackend::sequenceReservationQuery(const QString& table, int count) const
+{
+    Q_UNUSED(table);
+    Q_UNUSED(count);
+    return QString();
+}
+
+QString SqliteBackend::idListPredicate(const QString& column, const std::vector<int64_t>& ids) const
+{
+    QStringList items;
+    for (int64_t id : ids) {
+        items.append(QString::number(id));
+    }
+    return QString("%1 IN (%2)").arg(column, items.join(','));
+}
+
+QString SqliteBackend::blobLiteral(const QByteArray& data) const
+{
+    return QString("X'%1'").arg(QString::fromLatin1(data.toHex()));
+}
@@ -0,0 +1,36 @@
+#ifndef SQLITEBACKEND_H
+#define SQLITEBACKEND_H
+
+#include "storagebackend.h"
+
+// Встроенная SQLite через QSQLITE: файл БД на локальном диске, без сервера.
+// dbname - путь к файлу. Схема (аналог data/DBMaker.sql) создаётся при подключении.
+// Массивов нет, поэтому Bulk-запись и дельта-версии не поддерживаются,
+// длину трубки пересчитывает репозиторий один раз на сохранение.
+class SqliteBackend : public StorageBackend
+{
+public:
+    QString getDriverName() const override;
+
+    void configureConnection(QSqlDatabase& db, const QString& host, int port,
+                             const QString& dbname, const QString& user,
+                             const QString& password) const override;
+
+    QStringList getSessionStatements() const override;
+    QStringList getSchemaStatements() const override;
+    std::vector<SchemaMigration> getMigrations() const override;
+
+    QString tableExistsQuery(const QString& table) const override;
+    QString lastInsertIdQuery() const override;
+    QString sequenceReservationQuery(const QString& table, int count) const override;
+
+    QString idListPredicate(const QString& column, const std::vector<int64_t>& ids) const override;
+    QString blobLiteral(const QByteArray& data) const override;
+
+    bool supportsArrayOperations() const override { return false; }
+    bool supportsDeferredLengthUpdates() const override { return false; }
+    bool maintainsTubeLength() const override { return false; }
+    bool supportsSpatialIndex() const override { return false; }
+};
+
+#endif // SQLITEBACKEND_H
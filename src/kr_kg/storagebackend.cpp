@@ -0,0 +1,14 @@
+#include "storagebackend.h"
+#include "postgresbackend.h"
+#include "sqlitebackend.h"
+
+std::unique_ptr<StorageBackend> StorageBackend::create(const QString& driverName)
+{
+    if (driverName == "QPSQL") {
+        return std::make_unique<PostgresBackend>();
+    }
+    if (driverName == "QSQLITE") {
+        return std::make_unique<SqliteBackend>();
+    }
+    return nullptr;
+}
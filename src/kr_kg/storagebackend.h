@@ -0,0 +1,62 @@
+#ifndef STORAGEBACKEND_H
+#define STORAGEBACKEND_H
+
+#include <QSqlDatabase>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Особенности конкретной СУБД, которые нужны DatabaseManager и TubeRepository:
+// настройка соединения, схема, диалектные фрагменты SQL и поддерживаемые возможности.
+class StorageBackend
+{
+public:
+    // Шаг миграции схемы: применяется один раз, номер записывается в schema_version
+    struct SchemaMigration {
+        int version;
+        QString description;
+        QStringList statements;
+    };
+
+    virtual ~StorageBackend() = default;
+
+    // По имени драйвера Qt ("QPSQL", "QSQLITE"); nullptr для неподдерживаемого
+    static std::unique_ptr<StorageBackend> create(const QString& driverName);
+
+    virtual QString getDriverName() const = 0;
+
+    // Параметры соединения до open()
+    virtual void configureConnection(QSqlDatabase& db, const QString& host, int port,
+                                     const QString& dbname, const QString& user,
+                                     const QString& password) const = 0;
+
+    // Выполняются сразу после открытия соединения (настройки сессии, создание схемы)
+    virtual QStringList getSessionStatements() const = 0;
+    virtual QStringList getSchemaStatements() const = 0;
+
+    // Миграции по возрастанию version; пусто, если схема всегда создаётся в актуальном виде
+    virtual std::vector<SchemaMigration> getMigrations() const = 0;
+
+    virtual QString tableExistsQuery(const QString& table) const = 0;
+    virtual QString lastInsertIdQuery() const = 0;
+    // Пустая строка, если резервирование id заранее не поддерживается
+    virtual QString sequenceReservationQuery(const QString& table, int count) const = 0;
+
+    // Условие "column входит в список ids"
+    virtual QString idListPredicate(const QString& column, const std::vector<int64_t>& ids) const = 0;
+    virtual QString blobLiteral(const QByteArray& data) const = 0;
+
+    // Массивы (unnest, ANY, array_position): пакетная запись Bulk и дельта-версии
+    virtual bool supportsArrayOperations() const = 0;
+    // Отложенный до commit пересчёт длины через настройку сессии
+    virtual bool supportsDeferredLengthUpdates() const = 0;
+    // Длину трубки пересчитывают триггеры БД; иначе это делает репозиторий
+    virtual bool maintainsTubeLength() const = 0;
+    // Индекс GiST по центрам сечений; иначе пространственные запросы идут по сетке в памяти
+    virtual bool supportsSpatialIndex() const = 0;
+};
+
+#endif // STORAGEBACKEND_H
@@ -2,13 +2,20 @@
 #include <algorithm>
 #include <cmath>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 
 Tube::Tube()
+    : buildThreadCount(0)
 {
 }
 
 Tube::Tube(const Tube& other)
-    : sections(other.sections), segments(other.segments)
+    : sections(other.sections), segments(other.segments),
+    buildThreadCount(other.buildThreadCount)
 {
 }
 
@@ -18,6 +25,7 @@ Tube& Tube::operator=(const Tube& other)
     if (this != &other) {
         sections = other.sections;
         segments = other.segments;
+        buildThreadCount = other.buildThreadCount;
     }
     return *this;
 }
@@ -133,18 +141,74 @@ bool Tube::buildAllSegments()
 
     sortSectionsByZ();
 
-    bool allSuccessful = true;
+    // Сегменты между соседними сечениями независимы: каждый строится в свою ячейку,
+    // сечения только читаются
+    const int segmentCount = static_cast<int>(sections.size() - 1);
+    std::vector<Segment> built(segmentCount);
+    std::vector<char> succeeded(segmentCount, 0);
 
-     
-    for (size_t i = 0; i < sections.size() - 1; ++i) {
-        if (!buildSegment(static_cast<int>(i + 1), static_cast<int>(i + 2))) {
+    const int threads = buildThreadCount > 0 ? buildThreadCount : QThread::idealThreadCount();
+    runParallel(segmentCount, threads, [this, &built, &succeeded](int i) {
+        built[i] = Segment(i + 1, i + 1, i + 2);
+        succeeded[i] = built[i].buildNewConnectionMethod(sections[i], sections[i + 1]) ? 1 : 0;
+    });
+
+    // Порядок и нумерация - как при последовательном построении: неудачные пропускаются
+    bool allSuccessful = true;
+    segments.reserve(segmentCount);
+    for (int i = 0; i < segmentCount; ++i) {
+        if (!succeeded[i]) {
             allSuccessful = false;
+            continue;
         }
+        built[i].setSegmentIndex(static_cast<int>(segments.size() + 1));
+        segments.push_back(built[i]);
     }
 
     return allSuccessful;
 }
 
+void Tube::runParallel(int count, int threads, const std::function<void(int)>& task)
+{
+    // Состояние в shared_ptr: помощник, запущенный пулом после возврата, найдёт счётчик
+    // исчерпанным и task не вызовет
+    struct State {
+        std::atomic<int> next{0};
+        QSemaphore done;
+        std::function<void(int)> task;
+        int count = 0;
+    };
+    auto state = std::make_shared<State>();
+    state->task = task;
+    state->count = count;
+
+    auto work = [state]() {
+        for (int i = state->next.fetch_add(1); i < state->count; i = state->next.fetch_add(1)) {
+            state->task(i);
+            state->done.release();
+        }
+    };
+
+    const int helpers = std::max(0, std::min(threads, count) - 1);
+    for (int i = 0; i < helpers; ++i) {
+        QThreadPool::globalInstance()->start(work);
+    }
+
+    // Вызывающий поток тоже разбирает индексы, поэтому вызов из потока пула не блокируется
+    work();
+    state->done.acquire(count);
+}
+
+void Tube::setBuildThreadCount(int threads)
+{
+    buildThreadCount = std::max(0, threads);
+}
+
+int Tube::getBuildThreadCount() const
+{
+    return buildThreadCount;
+}
+
 bool Tube::buildSegment(int sectionIndex1, int sectionIndex2)
 {
     if (sectionIndex1 < 1 || sectionIndex1 > static_cast<int>(sections.size()) ||
@@ -392,28 +456,31 @@ Tube::TubeConstructionResult Tube::buildMesh() const
         return result;
     }
 
-    std::map<std::tuple<float, float, float>, int> interpolatedPointsMap;
+    // Вершины сетки по порядку: точки сечений, интерполированные концы соединительных рёбер
+    // (у каждого свой слот), затем вершины граней сегментов (generateFaces).
+    // Номер вершины выводится из (сечение, номер точки) - без сравнения координат
+    const MeshSize size = measureMesh();
+    TubeMesh& mesh = result.mesh;
+    mesh.vertices.reserve(size.vertices);
+    mesh.edges.reserve(size.edges);
+    mesh.faces.reserve(size.faces);
+    mesh.sectionStartIndices.reserve(sections.size());
+    mesh.pointsPerSection.reserve(sections.size());
 
     int totalVertices = 0;
     for (const auto& section : sections) {
-        result.mesh.sectionStartIndices.push_back(totalVertices);
-        result.mesh.pointsPerSection.push_back(static_cast<int>(section.getPointCount()));
-
-        for (const auto& point : section.points) {
-            result.mesh.vertices.push_back(point);
-
-            auto key = std::make_tuple(point.x, point.y, point.z);
-            interpolatedPointsMap[key] = totalVertices;
-            totalVertices++;
-        }
+        mesh.sectionStartIndices.push_back(totalVertices);
+        mesh.pointsPerSection.push_back(static_cast<int>(section.getPointCount()));
+        mesh.vertices.insert(mesh.vertices.end(), section.points.begin(), section.points.end());
+        totalVertices += static_cast<int>(section.getPointCount());
     }
 
     for (size_t s = 0; s < sections.size(); ++s) {
-        int startIdx = result.mesh.sectionStartIndices[s];
-        int pointCount = result.mesh.pointsPerSection[s];
+        int startIdx = mesh.sectionStartIndices[s];
+        int pointCount = mesh.pointsPerSection[s];
 
         for (int i = 0; i < pointCount; ++i) {
-            result.mesh.edges.emplace_back(
+            mesh.edges.emplace_back(
                 startIdx + i,
                 startIdx + ((i + 1) % pointCount)
                 );
@@ -430,51 +497,162 @@ Tube::TubeConstructionResult Tube::buildMesh() const
             continue;
         }
 
-        int startVertexOffset = result.mesh.sectionStartIndices[startSectionIdx - 1];
-        int endVertexOffset = result.mesh.sectionStartIndices[endSectionIdx - 1];
+        int startVertexOffset = mesh.sectionStartIndices[startSectionIdx - 1];
+        int endVertexOffset = mesh.sectionStartIndices[endSectionIdx - 1];
+        int startPointCount = mesh.pointsPerSection[startSectionIdx - 1];
+        int endPointCount = mesh.pointsPerSection[endSectionIdx - 1];
 
         for (size_t i = 0; i < segment.getConnectingEdgeCount(); ++i) {
             const Edge& edge = segment.getConnectingEdge(static_cast<int>(i + 1));
 
-            int startVertexIndex, endVertexIndex;
+            int startPoint = meshEndPoint(edge.isStartPointFromSection(), edge.getStartPointIndex(),
+                                          startPointCount);
+            if (startPoint < 0) {
+                result.problematicSections.emplace_back(startSectionIdx, endSectionIdx);
+                continue;
+            }
 
-            if (edge.isStartPointFromSection()) {
-                int pointIdx = edge.getStartPointIndex();
-                if (pointIdx >= 1 && pointIdx <= result.mesh.pointsPerSection[startSectionIdx - 1]) {
-                    startVertexIndex = startVertexOffset + pointIdx - 1;
-                } else {
-                    result.problematicSections.emplace_back(startSectionIdx, endSectionIdx);
-                    continue;
-                }
+            int startVertexIndex;
+            if (startPoint > 0) {
+                startVertexIndex = startVertexOffset + startPoint - 1;
             } else {
-                startVertexIndex = addInterpolatedPointToMesh(edge.getStartPoint(),
-                                                              result.mesh, interpolatedPointsMap);
+                startVertexIndex = static_cast<int>(mesh.vertices.size());
+                mesh.vertices.push_back(edge.getStartPoint());
             }
 
-            if (edge.isEndPointFromSection()) {
-                int pointIdx = edge.getEndPointIndex();
-                if (pointIdx >= 1 && pointIdx <= result.mesh.pointsPerSection[endSectionIdx - 1]) {
-                    endVertexIndex = endVertexOffset + pointIdx - 1;
-                } else {
-                    result.problematicSections.emplace_back(startSectionIdx, endSectionIdx);
-                    continue;
-                }
+            int endPoint = meshEndPoint(edge.isEndPointFromSection(), edge.getEndPointIndex(),
+                                        endPointCount);
+            if (endPoint < 0) {
+                result.problematicSections.emplace_back(startSectionIdx, endSectionIdx);
+                continue;
+            }
+
+            int endVertexIndex;
+            if (endPoint > 0) {
+                endVertexIndex = endVertexOffset + endPoint - 1;
             } else {
-                endVertexIndex = addInterpolatedPointToMesh(edge.getEndPoint(),
-                                                            result.mesh, interpolatedPointsMap);
+                endVertexIndex = static_cast<int>(mesh.vertices.size());
+                mesh.vertices.push_back(edge.getEndPoint());
             }
 
-            result.mesh.edges.emplace_back(startVertexIndex, endVertexIndex);
+            mesh.edges.emplace_back(startVertexIndex, endVertexIndex);
         }
     }
 
-    generateFaces(result.mesh);
+    generateFaces(mesh);
 
-    result.success = !result.mesh.vertices.empty() && !result.mesh.edges.empty();
+    result.success = !mesh.vertices.empty() && !mesh.edges.empty();
 
     return result;
 }
 
+Tube::MeshSize Tube::measureMesh() const
+{
+    // Тот же обход, что buildMesh и generateFaces, но только подсчёт
+    MeshSize size{0, 0, 0};
+
+    for (const auto& section : sections) {
+        size.vertices += section.getPointCount();
+        size.edges += section.getPointCount();
+    }
+
+    for (const auto& segment : segments) {
+        int startSectionIdx = segment.getStartSectionIndex();
+        int endSectionIdx = segment.getEndSectionIndex();
+
+        if (startSectionIdx < 1 || startSectionIdx > static_cast<int>(sections.size()) ||
+            endSectionIdx < 1 || endSectionIdx > static_cast<int>(sections.size())) {
+            continue;
+        }
+
+        int startPointCount = static_cast<int>(sections[startSectionIdx - 1].getPointCount());
+        int endPointCount = static_cast<int>(sections[endSectionIdx - 1].getPointCount());
+
+        for (const Edge& edge : segment.connectingEdges) {
+            int startPoint = meshEndPoint(edge.isStartPointFromSection(), edge.getStartPointIndex(),
+                                          startPointCount);
+            if (startPoint < 0) {
+                continue;
+            }
+            if (startPoint == 0) {
+                size.vertices++;
+            }
+
+            int endPoint = meshEndPoint(edge.isEndPointFromSection(), edge.getEndPointIndex(),
+                                        endPointCount);
+            if (endPoint < 0) {
+                continue;
+            }
+            if (endPoint == 0) {
+                size.vertices++;
+            }
+
+            size.edges++;
+        }
+    }
+
+    std::vector<int> startSlots;
+    std::vector<int> endSlots;
+    for (const auto& segment : segments) {
+        if (segment.getConnectingEdgeCount() < 3) {
+            continue;
+        }
+
+        int nextVertex = 0;
+        resetFaceSlots(segment, startSlots, endSlots);
+        for (const Edge& edge : segment.connectingEdges) {
+            faceVertexSlot(startSlots, edge.isStartPointFromSection() ? edge.getStartPointIndex() : 0,
+                           nextVertex);
+            faceVertexSlot(endSlots, edge.isEndPointFromSection() ? edge.getEndPointIndex() : 0,
+                           nextVertex);
+        }
+
+        size.vertices += nextVertex;
+        size.faces += 2 * segment.getConnectingEdgeCount();
+    }
+
+    return size;
+}
+
+int Tube::meshEndPoint(bool fromSection, int pointIndex, int pointCount)
+{
+    if (!fromSection) {
+        return 0;
+    }
+    return pointIndex >= 1 && pointIndex <= pointCount ? pointIndex : -1;
+}
+
+void Tube::resetFaceSlots(const Segment& segment, std::vector<int>& startSlots,
+                          std::vector<int>& endSlots)
+{
+    // По наибольшему номеру точки на каждом конце: рёбра сегмента могут ссылаться
+    // на сечения в обратном порядке (второй способ построения)
+    int maxStartPoint = 0;
+    int maxEndPoint = 0;
+    for (const Edge& edge : segment.connectingEdges) {
+        if (edge.isStartPointFromSection()) {
+            maxStartPoint = std::max(maxStartPoint, edge.getStartPointIndex());
+        }
+        if (edge.isEndPointFromSection()) {
+            maxEndPoint = std::max(maxEndPoint, edge.getEndPointIndex());
+        }
+    }
+    startSlots.assign(maxStartPoint, -1);
+    endSlots.assign(maxEndPoint, -1);
+}
+
+int Tube::faceVertexSlot(std::vector<int>& pointSlots, int pointIndex, int& nextVertex)
+{
+    if (pointIndex >= 1 && pointIndex <= static_cast<int>(pointSlots.size())) {
+        int& slot = pointSlots[pointIndex - 1];
+        if (slot == -1) {
+            slot = nextVertex++;
+        }
+        return slot;
+    }
+    return nextVertex++;
+}
+
 
 int Tube::findSectionByIndex(int sectionIndex) const
 {
@@ -564,92 +742,53 @@ bool Tube::validateSegmentConnection(const Segment& segment) const
            startIndex != endIndex;
 }
 
-int Tube::addInterpolatedPointToMesh(const Point3D& point, TubeMesh& mesh,
-                                     std::map<std::tuple<float, float, float>, int>& pointsMap) const
-{
-    const float EPSILON = 0.001f;
-
-     
-    float roundedX = std::round(point.x / EPSILON) * EPSILON;
-    float roundedY = std::round(point.y / EPSILON) * EPSILON;
-    float roundedZ = std::round(point.z / EPSILON) * EPSILON;
-
-    auto key = std::make_tuple(roundedX, roundedY, roundedZ);
-
-     
-    auto it = pointsMap.find(key);
-    if (it != pointsMap.end()) {
-        return it->second;   
-    }
-
-     
-    int newIndex = static_cast<int>(mesh.vertices.size());
-    mesh.vertices.push_back(point);
-    pointsMap[key] = newIndex;
-
-    return newIndex;
-}
-
 void Tube::generateFaces(TubeMesh& mesh) const
 {
-     
+    // У каждого сегмента свои вершины граней: точка сечения - одна на сегмент по номеру,
+    // интерполированная точка - своя у каждого конца ребра
+    std::vector<int> startSlots;
+    std::vector<int> endSlots;
+    std::vector<int> startIndices;
+    std::vector<int> endIndices;
+
     for (const auto& segment : segments) {
         if (segment.getConnectingEdgeCount() < 3) {
             continue;  
         }
 
-         
-        std::vector<std::pair<Point3D, int>> pointToVertexIndex;
+        const size_t edgeCount = segment.getConnectingEdgeCount();
+        resetFaceSlots(segment, startSlots, endSlots);
+        startIndices.resize(edgeCount);
+        endIndices.resize(edgeCount);
 
-         
-        auto findPointIndex = [&pointToVertexIndex](const Point3D& point) -> int {
-            const float EPSILON = 0.001f;
-            for (const auto& pair : pointToVertexIndex) {
-                if (Point3D::distance(pair.first, point) < EPSILON) {
-                    return pair.second;
-                }
-            }
-            return -1;
-        };
-
-         
-        for (size_t i = 0; i < segment.getConnectingEdgeCount(); ++i) {
+        int nextVertex = static_cast<int>(mesh.vertices.size());
+        for (size_t i = 0; i < edgeCount; ++i) {
             const Edge& edge = segment.getConnectingEdge(static_cast<int>(i + 1));
 
-             
-            int startIndex = findPointIndex(edge.getStartPoint());
-            if (startIndex == -1) {
-                startIndex = static_cast<int>(mesh.vertices.size());
-                pointToVertexIndex.push_back({edge.getStartPoint(), startIndex});
+            int start = faceVertexSlot(startSlots,
+                                       edge.isStartPointFromSection() ? edge.getStartPointIndex() : 0,
+                                       nextVertex);
+            startIndices[i] = start;
+            if (start == static_cast<int>(mesh.vertices.size())) {
                 mesh.vertices.push_back(edge.getStartPoint());
             }
 
-             
-            int endIndex = findPointIndex(edge.getEndPoint());
-            if (endIndex == -1) {
-                endIndex = static_cast<int>(mesh.vertices.size());
-                pointToVertexIndex.push_back({edge.getEndPoint(), endIndex});
+            int end = faceVertexSlot(endSlots,
+                                     edge.isEndPointFromSection() ? edge.getEndPointIndex() : 0,
+                                     nextVertex);
+            endIndices[i] = end;
+            if (end == static_cast<int>(mesh.vertices.size())) {
                 mesh.vertices.push_back(edge.getEndPoint());
             }
         }
 
-         
-        for (size_t i = 0; i < segment.getConnectingEdgeCount(); ++i) {
-            size_t nextI = (i + 1) % segment.getConnectingEdgeCount();
+        for (size_t i = 0; i < edgeCount; ++i) {
+            size_t nextI = (i + 1) % edgeCount;
 
-            const Edge& edge1 = segment.getConnectingEdge(static_cast<int>(i + 1));
-            const Edge& edge2 = segment.getConnectingEdge(static_cast<int>(nextI + 1));
-
-             
-            int v1 = findPointIndex(edge1.getStartPoint());   
-            int v2 = findPointIndex(edge1.getEndPoint());     
-            int v3 = findPointIndex(edge2.getStartPoint());   
-            int v4 = findPointIndex(edge2.getEndPoint());     
-
-             
-            if (v1 == -1 || v2 == -1 || v3 == -1 || v4 == -1) {
-                continue;  
-            }
+            int v1 = startIndices[i];
+            int v2 = endIndices[i];
+            int v3 = startIndices[nextI];
+            int v4 = endIndices[nextI];
 
              
              
@@ -662,63 +801,18 @@ void Tube::generateFaces(TubeMesh& mesh) const
             mesh.faces.push_back(face2);
         }
     }
-
-     
 }
 
  
 void Tube::addSectionEndCapFaces(TubeMesh& mesh, int sectionIndex, bool isStartCap) const
 {
-    if (sectionIndex < 0 || sectionIndex >= static_cast<int>(sections.size())) {
-        return;
-    }
-
-    const Section& section = sections[sectionIndex];
-    if (section.getPointCount() < 3) {
+    // Контур сечения уже лежит в сетке buildMesh подряд с sectionStartIndices[sectionIndex]:
+    // крышка - веер по этим вершинам, совпадающие координаты искать не нужно
+    if (sectionIndex < 0 || sectionIndex >= static_cast<int>(mesh.sectionStartIndices.size())) {
         return;
     }
 
-     
-    std::vector<int> sectionVertexIndices;
-    for (size_t i = 0; i < section.getPointCount(); ++i) {
-        const Point3D& point = section.getPoint(static_cast<int>(i + 1));
-
-         
-        int vertexIndex = -1;
-        for (size_t j = 0; j < mesh.vertices.size(); ++j) {
-            if (Point3D::distance(mesh.vertices[j], point) < 0.001f) {
-                vertexIndex = static_cast<int>(j);
-                break;
-            }
-        }
-
-         
-        if (vertexIndex == -1) {
-            vertexIndex = static_cast<int>(mesh.vertices.size());
-            mesh.vertices.push_back(point);
-        }
-
-        sectionVertexIndices.push_back(vertexIndex);
-    }
-
-     
-    for (size_t i = 1; i < sectionVertexIndices.size() - 1; ++i) {
-        std::array<int, 3> face;
-
-        if (isStartCap) {
-             
-            face = {sectionVertexIndices[0],
-                    sectionVertexIndices[i + 1],
-                    sectionVertexIndices[i]};
-        } else {
-             
-            face = {sectionVertexIndices[0],
-                    sectionVertexIndices[i],
-                    sectionVertexIndices[i + 1]};
-        }
-
-        mesh.faces.push_back(face);
-    }
+    addSectionFaces(mesh, sectionIndex, !isStartCap);
 }
 
 void Tube::addSectionFaces(TubeMesh& mesh, int sectionIndex, bool inward) const
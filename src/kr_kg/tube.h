@@ -6,7 +6,7 @@
 #include <vector>
 #include <array>
 #include <utility>
-#include <map>
+#include <functional>
 
 class Tube
 {
@@ -41,6 +41,10 @@ public:
     bool buildSegment(int sectionIndex1, int sectionIndex2);     
     void rebuildAllSegments();   
 
+    // Число потоков buildAllSegments: 0 - QThread::idealThreadCount(), 1 - последовательно
+    void setBuildThreadCount(int threads);
+    int getBuildThreadCount() const;
+
 
     const std::vector<Section>& getSections() const;
     void clear();
@@ -108,14 +112,33 @@ public:
     void updateSegmentGeometry();
 
 private:
+    int buildThreadCount;
+
+    // Выполнить task(0..count-1) в threads потоках: вызывающий поток участвует сам,
+    // помощники из QThreadPool::globalInstance() разбирают индексы из общего счётчика
+    static void runParallel(int count, int threads, const std::function<void(int)>& task);
+
     bool validateSegmentConnection(const Segment& segment) const;
     void generateFaces(TubeMesh& mesh) const;
     void addSectionEndCapFaces(TubeMesh& mesh, int sectionIndex, bool isStartCap) const;
 
     bool buildNewSegment(int startSectionIndex, int endSectionIndex);
 
-    int addInterpolatedPointToMesh(const Point3D& point, TubeMesh& mesh,
-                                   std::map<std::tuple<float, float, float>, int>& pointsMap) const;
+    // Точные размеры массивов сетки для buildMesh
+    struct MeshSize {
+        size_t vertices;
+        size_t edges;
+        size_t faces;
+    };
+    MeshSize measureMesh() const;
+
+    // Номер точки сечения для конца соединительного ребра: 1..pointCount,
+    // 0 - интерполированная точка, -1 - номер вне сечения
+    static int meshEndPoint(bool fromSection, int pointIndex, int pointCount);
+    static void resetFaceSlots(const Segment& segment, std::vector<int>& startSlots,
+                               std::vector<int>& endSlots);
+    // Вершина грани: занятый слот точки сечения или следующий номер nextVertex
+    static int faceVertexSlot(std::vector<int>& pointSlots, int pointIndex, int& nextVertex);
 
     void addSectionFaces(TubeMesh& mesh, int sectionIndex, bool inward) const;
 };
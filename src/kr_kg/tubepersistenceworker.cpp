@@ -0,0 +1,179 @@
+#include "tubepersistenceworker.h"
+#include "tuberepository.h"
+#include "connectionpool.h"
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDebug>
+
+TubePersistenceWorker::TubePersistenceWorker(QObject *parent)
+    : QObject(parent)
+    , nextJobId(1)
+    , unfinishedJobs(0)
+    , keyframeInterval(10)
+    , chainTubeId(-1)
+{
+}
+
+TubePersistenceWorker::~TubePersistenceWorker()
+{
+    // Деструктор выполняется в потоке воркера (deleteLater по QThread::finished),
+    // поэтому здесь можно закрыть соединения пула, созданные этим потоком
+    DatabaseManager::getConnectionPool().releaseCurrentThreadConnections();
+}
+
+int TubePersistenceWorker::enqueueSave(std::shared_ptr<const Tube> tube, int verId, qint64 previousTubeId,
+                                       std::shared_ptr<const Tube> previousTube)
+{
+    int jobId;
+    {
+        QMutexLocker locker(&mutex);
+        jobId = nextJobId++;
+        jobs.push_back({jobId, std::move(tube), verId, previousTubeId, std::move(previousTube)});
+        ++unfinishedJobs;
+    }
+
+    qDebug() << "TubePersistenceWorker: queued job" << jobId << "ver_id:" << verId
+             << "previousTubeId:" << previousTubeId;
+
+    // Очередь разбирается в потоке воркера
+    QMetaObject::invokeMethod(this, &TubePersistenceWorker::processQueue, Qt::QueuedConnection);
+    return jobId;
+}
+
+int TubePersistenceWorker::getPendingJobCount() const
+{
+    QMutexLocker locker(&mutex);
+    return unfinishedJobs;
+}
+
+void TubePersistenceWorker::waitForIdle()
+{
+    QMutexLocker locker(&mutex);
+    while (unfinishedJobs > 0) {
+        idleCondition.wait(&mutex);
+    }
+}
+
+void TubePersistenceWorker::setKeyframeInterval(int interval)
+{
+    QMutexLocker locker(&mutex);
+    keyframeInterval = interval;
+}
+
+void TubePersistenceWorker::processQueue()
+{
+    while (true) {
+        SaveJob job;
+        int keyframes;
+        {
+            QMutexLocker locker(&mutex);
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            keyframes = keyframeInterval;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        QString error;
+        qint64 previousTubeId = -1;
+        std::shared_ptr<const Tube> previousTube;
+        std::shared_ptr<const Tube> storedTube;
+        qint64 newTubeId = executeJob(job, keyframes, error, previousTubeId, previousTube, storedTube);
+
+        // Следующая цепная задача продолжает от этой версии, а при ошибке - от её
+        // предшественника: иначе она привязалась бы к трубке, сохранённой раньше
+        // (возможно, до перехода назад по истории и уже удалённой)
+        if (newTubeId != -1) {
+            chainTubeId = newTubeId;
+            chainTube = std::move(storedTube);
+        } else {
+            chainTubeId = previousTubeId;
+            chainTube = std::move(previousTube);
+        }
+
+        {
+            QMutexLocker locker(&mutex);
+            if (--unfinishedJobs == 0) {
+                idleCondition.wakeAll();
+            }
+        }
+
+        if (newTubeId == -1) {
+            qDebug() << "TubePersistenceWorker: job" << job.jobId << "failed:" << error;
+            emit saveFailed(job.jobId, job.verId, error);
+            continue;
+        }
+
+        qint64 elapsed = timer.elapsed();
+        qDebug() << "TubePersistenceWorker: job" << job.jobId << "saved tube" << newTubeId
+                 << "in" << elapsed << "ms";
+        emit tubeSaved(job.jobId, newTubeId, job.verId, elapsed);
+    }
+}
+
+qint64 TubePersistenceWorker::executeJob(const SaveJob& job, int keyframes, QString& error,
+                                        qint64& resolvedPreviousTubeId,
+                                        std::shared_ptr<const Tube>& resolvedPreviousTube,
+                                        std::shared_ptr<const Tube>& storedTube)
+{
+    // Предшественник определяется до всего остального: при любой ошибке он нужен цепочке
+    if (job.previousTubeId == CHAIN_TO_PREVIOUS_JOB) {
+        resolvedPreviousTubeId = chainTubeId;
+        resolvedPreviousTube = chainTube;
+    } else {
+        resolvedPreviousTubeId = job.previousTubeId;
+        resolvedPreviousTube = job.previousTube;
+    }
+    const qint64 previousTubeId = resolvedPreviousTubeId;
+    const Tube* previousTube = resolvedPreviousTube.get();
+
+    ConnectionPool::Guard connection = DatabaseManager::getConnectionPool().acquire();
+    if (!connection.isValid()) {
+        error = DatabaseManager::getConnectionPool().getLastError();
+        return -1;
+    }
+
+    TubeRepository repository(*connection);
+    // Версии с неизменной топологией храним как дельты изменённых точек
+    repository.setVersionStorage(TubeRepository::VersionStorage::Delta);
+    repository.setKeyframeInterval(keyframes);
+    repository.setPackedGeometry(true);
+    repository.setDeferLengthUpdates(true);
+
+    // Следующая версия цепочки сравнивается с тем, что реально записано,
+    // а не с job.tube: иначе незаписанные малые сдвиги копились бы от версии к версии
+    auto stored = std::make_shared<Tube>();
+    int64_t newTubeId = repository.saveTube(*job.tube, job.verId, previousTubeId,
+                                            TubeRepository::SaveMode::Bulk, previousTube,
+                                            stored.get());
+    if (newTubeId == -1) {
+        error = repository.getLastError();
+        return -1;
+    }
+    storedTube = std::move(stored);
+
+    // Если есть предыдущая версия, связываем трубки и их сущности
+    if (previousTubeId != -1) {
+        if (!repository.linkTubeVersions(previousTubeId, newTubeId)) {
+            qDebug() << "Warning: Failed to link tube versions:" << repository.getLastError();
+            // Не критично, продолжаем
+        }
+
+        if (!repository.linkVersionEntities(previousTubeId, newTubeId)) {
+            qDebug() << "Warning: Failed to link version entities:" << repository.getLastError();
+        }
+
+        int64_t linkedFutureId = repository.getFutureTubeId(previousTubeId);
+        int64_t linkedPastId = repository.getPastTubeId(newTubeId);
+        if (linkedFutureId != newTubeId || linkedPastId != previousTubeId) {
+            qWarning() << "WARNING: Tube version links are not properly set!"
+                       << previousTubeId << "->" << newTubeId;
+        }
+    }
+
+    return newTubeId;
+}
@@ -0,0 +1,77 @@
+#ifndef TUBEPERSISTENCEWORKER_H
+#define TUBEPERSISTENCEWORKER_H
+
+#include "tube.h"
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <deque>
+#include <memory>
+
+// Фоновое сохранение версий трубки.
+// Объект переносится в отдельный QThread и пишет в БД через соединение из пула,
+// задачи выполняются строго в порядке постановки, чтобы не рвать цепочку версий.
+class TubePersistenceWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    // previousTubeId задачи: взять id трубки, сохранённой предыдущей задачей очереди
+    // (если предыдущая задача не удалась - id, к которому была бы привязана она)
+    static constexpr qint64 CHAIN_TO_PREVIOUS_JOB = -2;
+
+    explicit TubePersistenceWorker(QObject *parent = nullptr);
+    ~TubePersistenceWorker();
+
+    // Потокобезопасно. Трубка передаётся неизменяемым снимком, возвращается номер задачи.
+    // previousTube - содержимое версии previousTubeId в том виде, в каком оно хранится в БД,
+    // с ним сравнивается дельта (для CHAIN_TO_PREVIOUS_JOB - версия, записанная предыдущей задачей)
+    int enqueueSave(std::shared_ptr<const Tube> tube, int verId, qint64 previousTubeId,
+                    std::shared_ptr<const Tube> previousTube = nullptr);
+
+    int getPendingJobCount() const;
+
+    // Блокирует вызывающий поток, пока очередь не опустеет
+    void waitForIdle();
+
+    void setKeyframeInterval(int interval);
+
+signals:
+    void tubeSaved(int jobId, qint64 tubeId, int verId, qint64 elapsedMs);
+    void saveFailed(int jobId, int verId, const QString& error);
+
+private slots:
+    void processQueue();
+
+private:
+    struct SaveJob {
+        int jobId;
+        std::shared_ptr<const Tube> tube;
+        int verId;
+        qint64 previousTubeId;
+        std::shared_ptr<const Tube> previousTube;
+    };
+
+    // resolvedPreviousTubeId/resolvedPreviousTube - предшественник, к которому привязана версия;
+    // storedTube - сохранённая версия в том виде, в каком её восстановит загрузка
+    qint64 executeJob(const SaveJob& job, int keyframes, QString& error,
+                      qint64& resolvedPreviousTubeId, std::shared_ptr<const Tube>& resolvedPreviousTube,
+                      std::shared_ptr<const Tube>& storedTube);
+
+    mutable QMutex mutex;
+    QWaitCondition idleCondition;
+    std::deque<SaveJob> jobs;
+    int nextJobId;
+    // Поставленные, но ещё не завершённые задачи (включая выполняемую)
+    int unfinishedJobs;
+    int keyframeInterval;
+
+    // К чему привязывать задачу с CHAIN_TO_PREVIOUS_JOB: трубка, сохранённая предыдущей
+    // задачей (в записанном виде), а если та не удалась - её предшественник
+    // (цепочка продолжается с того же места)
+    qint64 chainTubeId;
+    std::shared_ptr<const Tube> chainTube;
+};
+
+#endif // TUBEPERSISTENCEWORKER_H
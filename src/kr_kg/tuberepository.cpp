@@ -1,35 +1,157 @@
 #include "tuberepository.h"
+#include "storagebackend.h"
+#include "sectioncentergrid.h"
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <QMutex>
+#include <algorithm>
 #include <cmath>
+#include <limits>
+
+// Сетка центров сечений общая для всех репозиториев процесса: репозиторий обычно создаётся
+// на одну операцию, а сетка строится полным чтением section. generation растёт при каждом
+// сбросе - сетка, собранная одновременно с записью, в кэш уже не попадёт
+struct SharedSectionGrid {
+    QMutex mutex;
+    QString databaseKey;
+    std::shared_ptr<const SectionCenterGrid> grid;
+    quint64 generation = 0;
+};
+
+static SharedSectionGrid& sharedSectionGrid()
+{
+    static SharedSectionGrid instance;
+    return instance;
+}
+
+static QString sectionGridKey(const DatabaseManager& db)
+{
+    const DatabaseManager::ConnectionParameters parameters = db.getConnectionParameters();
+    return QString("%1:%2:%3:%4").arg(parameters.driver, parameters.host)
+        .arg(parameters.port).arg(parameters.dbname);
+}
+
+// Сброс при выходе из записывающей операции, т.е. после commit: при сбросе в начале
+// другой поток успел бы пересобрать сетку по ещё не записанным данным
+class SectionGridReset
+{
+public:
+    ~SectionGridReset()
+    {
+        SharedSectionGrid& shared = sharedSectionGrid();
+        QMutexLocker locker(&shared.mutex);
+        shared.grid.reset();
+        ++shared.generation;
+    }
+};
 
 TubeRepository::TubeRepository()
-    : db(DatabaseManager::getInstance())
+    : TubeRepository(DatabaseManager::getInstance())
+{
+}
+
+TubeRepository::TubeRepository(DatabaseManager& database)
+    : db(database)
+    , lastLoadTimeMs(0)
+    , lastLoadedVerId(-1)
+    , insertBatchSize(DEFAULT_INSERT_BATCH_SIZE)
+    , versionStorage(VersionStorage::Snapshot)
+    , deltaEpsilon(DEFAULT_DELTA_EPSILON)
+    , keyframeInterval(DEFAULT_KEYFRAME_INTERVAL)
+    , packedGeometry(false)
+    , deferLengthUpdates(false)
+    , spatialSearchMargin(DEFAULT_SPATIAL_SEARCH_MARGIN)
+{
+}
+
+void TubeRepository::setInsertBatchSize(int rows)
+{
+    // Ограничение сверху: PostgreSQL допускает не более 65535 параметров в запросе
+    insertBatchSize = std::max(1, std::min(rows, MAX_INSERT_BATCH_SIZE));
+}
+
+int TubeRepository::getInsertBatchSize() const
 {
+    return insertBatchSize;
 }
 
 TubeRepository::~TubeRepository()
 {
 }
 
-int64_t TubeRepository::saveTube(const Tube& tube, int verId, int64_t previousTubeId)
+int64_t TubeRepository::saveTube(const Tube& tube, int verId, int64_t previousTubeId,
+                                 SaveMode mode, const Tube* previousTube, Tube* storedTube)
 {
+    DatabaseManager::OperationScope operation(db, "save");
+    // Центры сечений меняются - сетка перестраивается при следующем запросе
+    SectionGridReset gridReset;
     qDebug() << "TubeRepository::saveTube - Starting tube save operation, verId:" << verId;
-    qDebug() << "Previous tube ID:" << previousTubeId;
+    qDebug() << "Previous tube ID:" << previousTubeId
+             << "mode:" << (mode == SaveMode::Bulk ? "bulk"
+                            : mode == SaveMode::Batched ? "batched" : "per-row");
 
     if (!db.isConnected()) {
         setLastError("Database is not connected");
         return -1;
     }
 
+    // Без массивов (SQLite) пакетные режимы заменяются подготовленными построчными
+    // вставками в одной транзакции - для встроенной БД это и есть быстрый путь
+    const StorageBackend& backend = db.getBackend();
+    if (mode != SaveMode::PerRow && !backend.supportsArrayOperations()) {
+        qDebug() << "Backend" << backend.getDriverName() << "has no array support, saving per-row";
+        mode = SaveMode::PerRow;
+    }
+
     if (!validateTubeData(tube)) {
         setLastError("Tube data validation failed");
         return -1;
     }
 
+    // Дельта-хранение: если топология не изменилась, пишем только сдвинутые точки.
+    // Каждая keyframeInterval-я версия цепочки сохраняется полным снимком.
+    if (versionStorage == VersionStorage::Delta && previousTubeId != -1
+        && backend.supportsArrayOperations()) {
+        std::vector<PointDelta> deltas;
+        int chainDepth = getDeltaChainDepth(previousTubeId);
+
+        if (chainDepth == -1) {
+            qDebug() << "Delta storage: failed to resolve base chain, writing snapshot";
+        } else if (keyframeInterval > 0 && chainDepth + 1 >= keyframeInterval) {
+            qDebug() << "Delta storage: keyframe due after" << chainDepth << "deltas, writing snapshot";
+        } else if (!previousTube) {
+            // Восстанавливать базовую версию из БД ради сравнения точек не будем:
+            // стоимость сохранения снова росла бы с размером трубки и глубиной цепочки
+            qDebug() << "Delta storage: previous version is not in memory, writing snapshot";
+        } else if (!collectPointDeltas(*previousTube, tube, deltas)) {
+            qDebug() << "Delta storage: topology differs from base version, writing snapshot";
+        } else {
+            // Загрузка соберёт версию из базовой и записанных точек, а не из tube
+            Tube reconstructed = *previousTube;
+            applyPointDeltas(reconstructed, deltas);
+
+            int64_t tubeId = saveTubeDelta(verId, previousTubeId, deltas, reconstructed);
+            if (tubeId != -1 && storedTube) {
+                *storedTube = std::move(reconstructed);
+            }
+            return tubeId;
+        }
+    }
+
     if (!db.beginTransaction()) {
         setLastError("Failed to begin transaction: " + db.getLastError());
         return -1;
     }
 
+    // Пересчёт длины трубки триггерами - один раз при commit, а не после каждого оператора
+    if (deferLengthUpdates && backend.supportsDeferredLengthUpdates()
+        && !db.execute("SET LOCAL tube.defer_length_calc = 'on'")) {
+        db.rollbackTransaction();
+        setLastError("Failed to defer tube length calculation: " + db.getLastError());
+        return -1;
+    }
+
     // Создаем новую запись трубки
     int64_t tubeId = insertTubeRecord(verId);
     if (tubeId == -1) {
@@ -39,11 +161,36 @@ int64_t TubeRepository::saveTube(const Tube& tube, int verId, int64_t previousTu
     }
     qDebug() << "Tube record inserted with id:" << tubeId;
 
+    if (mode == SaveMode::Bulk) {
+        if (!saveTubeBulk(tubeId, tube, verId, previousTubeId)) {
+            db.rollbackTransaction();
+            setLastError("Failed to save tube in bulk mode: " + lastError);
+            return -1;
+        }
+
+        if (!backend.maintainsTubeLength() && !updateTubeLength(tubeId)) {
+            db.rollbackTransaction();
+            setLastError("Failed to update tube length: " + lastError);
+            return -1;
+        }
+
+        if (!db.commitTransaction()) {
+            db.rollbackTransaction();
+            setLastError("Failed to commit transaction: " + db.getLastError());
+            return -1;
+        }
+
+        qDebug() << "TubeRepository::saveTube - Tube saved successfully (bulk) with id:" << tubeId;
+        if (storedTube) {
+            *storedTube = tube;
+        }
+        return tubeId;
+    }
+
     // Маппинги для связей между версиями
-    std::map<int, int64_t> sectionIndexToNewId;  // index -> new section_id
-    std::map<int, int64_t> sectionIndexToOldId;  // index -> old section_id
-    std::map<PointKey, int64_t> pointIdsMap;
-    std::map<int64_t, int64_t> oldPointIdToNewPointId;  // old point_id -> new point_id
+    IdByIndex sectionIndexToOldId;  // index -> old section_id
+    PointIdIndex pointIds;
+    resetPointIdIndex(tube, pointIds);
 
     // Если это не первая версия, загружаем старые ID
     if (previousTubeId != -1) {
@@ -56,23 +203,27 @@ int64_t TubeRepository::saveTube(const Tube& tube, int verId, int64_t previousTu
 
     // Сохраняем сечения
     if (!saveSectionsWithVersioning(tubeId, tube, verId, previousTubeId,
-                                    pointIdsMap, sectionIndexToNewId,
-                                    sectionIndexToOldId, oldPointIdToNewPointId)) {
+                                    pointIds, sectionIndexToOldId, mode)) {
         db.rollbackTransaction();
         setLastError("Failed to save sections: " + lastError);
         return -1;
     }
-    qDebug() << "All sections saved successfully. Total points:" << pointIdsMap.size();
+    qDebug() << "All sections saved successfully. Total points:" << pointIds.count;
 
     // Сохраняем сегменты
-    if (!saveSegmentsWithVersioning(tubeId, tube, verId, previousTubeId,
-                                    pointIdsMap, oldPointIdToNewPointId)) {
+    if (!saveSegmentsWithVersioning(tubeId, tube, verId, previousTubeId, pointIds, mode)) {
         db.rollbackTransaction();
         setLastError("Failed to save segments: " + lastError);
         return -1;
     }
     qDebug() << "All segments saved successfully";
 
+    if (!backend.maintainsTubeLength() && !updateTubeLength(tubeId)) {
+        db.rollbackTransaction();
+        setLastError("Failed to update tube length: " + lastError);
+        return -1;
+    }
+
     if (!db.commitTransaction()) {
         db.rollbackTransaction();
         setLastError("Failed to commit transaction: " + db.getLastError());
@@ -80,21 +231,30 @@ int64_t TubeRepository::saveTube(const Tube& tube, int verId, int64_t previousTu
     }
 
     qDebug() << "TubeRepository::saveTube - Tube saved successfully with id:" << tubeId;
+    if (storedTube) {
+        *storedTube = tube;
+    }
     return tubeId;
 }
 
-bool TubeRepository::loadOldSectionIds(int64_t tubeId, std::map<int, int64_t>& sectionIndexToId)
+bool TubeRepository::loadOldSectionIds(int64_t tubeId, IdByIndex& sectionIndexToId)
 {
-    QString query = QString(
-                        "SELECT id, index FROM section WHERE tube_id = %1 ORDER BY index"
-                        ).arg(tubeId);
+    QSqlQuery* query = db.getPreparedQuery(
+        "select_section_ids",
+        "SELECT id, \"index\" FROM section WHERE tube_id = :tube_id ORDER BY \"index\"");
+    if (!query) {
+        return false;
+    }
 
-    QSqlQuery result = db.executeQuery(query);
+    query->bindValue(":tube_id", static_cast<qlonglong>(tubeId));
+    if (!db.executePrepared(*query)) {
+        return false;
+    }
 
-    while (result.next()) {
-        int64_t sectionId = result.value(0).toLongLong();
-        int index = result.value(1).toInt();
-        sectionIndexToId[index] = sectionId;
+    while (query->next()) {
+        int64_t sectionId = query->value(0).toLongLong();
+        int index = query->value(1).toInt();
+        setIdAtIndex(sectionIndexToId, index, sectionId);
     }
 
     return true;
@@ -105,10 +265,9 @@ bool TubeRepository::saveSectionsWithVersioning(
     const Tube& tube,
     int verId,
     int64_t previousTubeId,
-    std::map<PointKey, int64_t>& pointIdsMap,
-    std::map<int, int64_t>& sectionIndexToNewId,
-    std::map<int, int64_t>& sectionIndexToOldId,
-    std::map<int64_t, int64_t>& oldPointIdToNewPointId)
+    PointIdIndex& pointIds,
+    const IdByIndex& sectionIndexToOldId,
+    SaveMode mode)
 {
     qDebug() << "Saving" << tube.getSectionCount() << "sections with versioning";
 
@@ -117,10 +276,7 @@ bool TubeRepository::saveSectionsWithVersioning(
         int sectionIndex = section.sectionIndex;
 
         // Получаем старый section_id если есть
-        int64_t oldSectionId = -1;
-        if (previousTubeId != -1 && sectionIndexToOldId.find(sectionIndex) != sectionIndexToOldId.end()) {
-            oldSectionId = sectionIndexToOldId[sectionIndex];
-        }
+        int64_t oldSectionId = previousTubeId != -1 ? idAtIndex(sectionIndexToOldId, sectionIndex) : -1;
 
         // Вставляем новое сечение
         int64_t newSectionId = insertSectionWithPast(tubeId, section, verId, sectionIndex, oldSectionId);
@@ -130,22 +286,18 @@ bool TubeRepository::saveSectionsWithVersioning(
             return false;
         }
 
-        sectionIndexToNewId[sectionIndex] = newSectionId;
-
         // Обновляем старое сечение, добавляя ссылку на будущее
         if (oldSectionId != -1) {
-            QString updateQuery = QString(
-                                      "UPDATE section SET future_section_id = %1 WHERE id = %2"
-                                      ).arg(newSectionId).arg(oldSectionId);
-            db.executeQuery(updateQuery);
+            if (!setFutureId("section", oldSectionId, newSectionId)) {
+                return false;
+            }
         }
 
         qDebug() << "Section" << sectionIndex << "inserted with id:" << newSectionId
                  << "(old id:" << oldSectionId << ")";
 
         // Сохраняем точки с версионностью
-        if (!savePointsWithVersioning(newSectionId, oldSectionId, section, verId,
-                                      pointIdsMap, oldPointIdToNewPointId)) {
+        if (!savePointsWithVersioning(newSectionId, oldSectionId, section, verId, pointIds, mode)) {
             setLastError(QString("Failed to save points for section %1: %2")
                              .arg(sectionIndex).arg(lastError));
             return false;
@@ -164,25 +316,28 @@ int64_t TubeRepository::insertSectionWithPast(
 {
     Point3D center = section.getCenter();
 
-    QString query;
-    if (pastSectionId == -1) {
-        query = QString(
-                    "INSERT INTO section (tube_id, ver_id, index, x_cen, y_cen, z_cen) "
-                    "VALUES (%1, %2, %3, %4, %5, %6) "
-                    "RETURNING id"
-                    ).arg(tubeId).arg(verId).arg(index).arg(center.x).arg(center.y).arg(center.z);
-    } else {
-        query = QString(
-                    "INSERT INTO section (tube_id, ver_id, index, x_cen, y_cen, z_cen, past_section_id) "
-                    "VALUES (%1, %2, %3, %4, %5, %6, %7) "
-                    "RETURNING id"
-                    ).arg(tubeId).arg(verId).arg(index).arg(center.x).arg(center.y).arg(center.z).arg(pastSectionId);
+    QSqlQuery* query = db.getPreparedQuery(
+        "insert_section",
+        "INSERT INTO section (tube_id, ver_id, \"index\", x_cen, y_cen, z_cen, past_section_id, contour) "
+        "VALUES (:tube_id, :ver_id, :index, :x, :y, :z, :past_id, :contour) "
+        "RETURNING id");
+    if (!query) {
+        setLastError("Failed to prepare section insert: " + db.getLastError());
+        return -1;
     }
 
-    QSqlQuery result = db.executeQuery(query);
+    query->bindValue(":tube_id", static_cast<qlonglong>(tubeId));
+    query->bindValue(":ver_id", verId);
+    query->bindValue(":index", index);
+    query->bindValue(":x", static_cast<double>(center.x));
+    query->bindValue(":y", static_cast<double>(center.y));
+    query->bindValue(":z", static_cast<double>(center.z));
+    query->bindValue(":past_id", idOrNull(pastSectionId));
+    query->bindValue(":contour", packedGeometry ? QVariant(packContour(section))
+                                                : QVariant(QMetaType::fromType<QByteArray>()));
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    if (db.executePrepared(*query) && query->next()) {
+        return query->value(0).toLongLong();
     }
 
     setLastError("Failed to get section id after insert");
@@ -194,37 +349,48 @@ bool TubeRepository::savePointsWithVersioning(
     int64_t oldSectionId,
     const Section& section,
     int verId,
-    std::map<PointKey, int64_t>& pointIdsMap,
-    std::map<int64_t, int64_t>& oldPointIdToNewPointId)
+    PointIdIndex& pointIds,
+    SaveMode mode)
 {
     qDebug() << "Saving" << section.getPointCount() << "points for section id:" << newSectionId;
 
     // Загружаем старые точки если есть
-    std::map<int, int64_t> oldPointIndices;  // index_in_section -> point_id
+    IdByIndex oldPointIndices;  // index_in_section -> point_id
     if (oldSectionId != -1) {
-        QString query = QString(
-                            "SELECT id, index_in_section FROM point "
-                            "WHERE section_id = %1 AND index_in_section IS NOT NULL "
-                            "ORDER BY index_in_section"
-                            ).arg(oldSectionId);
+        QSqlQuery* query = db.getPreparedQuery(
+            "select_point_ids",
+            "SELECT id, index_in_section FROM point "
+            "WHERE section_id = :section_id AND index_in_section IS NOT NULL "
+            "ORDER BY index_in_section");
+        if (!query) {
+            setLastError("Failed to prepare point lookup: " + db.getLastError());
+            return false;
+        }
 
-        QSqlQuery result = db.executeQuery(query);
-        while (result.next()) {
-            int64_t pointId = result.value(0).toLongLong();
-            int index = result.value(1).toInt();
-            oldPointIndices[index] = pointId;
+        query->bindValue(":section_id", static_cast<qlonglong>(oldSectionId));
+        if (!db.executePrepared(*query)) {
+            setLastError("Failed to load old points: " + db.getLastError());
+            return false;
+        }
+
+        oldPointIndices.assign(section.getPointCount() + 1, -1);
+        while (query->next()) {
+            int64_t pointId = query->value(0).toLongLong();
+            int index = query->value(1).toInt();
+            setIdAtIndex(oldPointIndices, index, pointId);
         }
     }
 
+    if (mode == SaveMode::Batched) {
+        return savePointsBatched(newSectionId, section, verId, oldPointIndices, pointIds);
+    }
+
     for (size_t i = 0; i < section.getPointCount(); ++i) {
         const Point3D& point = section.getPoint(static_cast<int>(i + 1));
         int indexInSection = static_cast<int>(i + 1);
 
         // Получаем старый point_id если есть
-        int64_t oldPointId = -1;
-        if (oldPointIndices.find(indexInSection) != oldPointIndices.end()) {
-            oldPointId = oldPointIndices[indexInSection];
-        }
+        int64_t oldPointId = idAtIndex(oldPointIndices, indexInSection);
 
         // Вставляем новую точку
         int64_t newPointId = insertPointWithPast(newSectionId, point, verId, indexInSection, oldPointId);
@@ -236,16 +402,12 @@ bool TubeRepository::savePointsWithVersioning(
 
         // Обновляем старую точку
         if (oldPointId != -1) {
-            QString updateQuery = QString(
-                                      "UPDATE point SET future_point_id = %1 WHERE id = %2"
-                                      ).arg(newPointId).arg(oldPointId);
-            db.executeQuery(updateQuery);
-
-            oldPointIdToNewPointId[oldPointId] = newPointId;
+            if (!setFutureId("point", oldPointId, newPointId)) {
+                return false;
+            }
         }
 
-        PointKey key = makePointKey(point);
-        pointIdsMap[key] = newPointId;
+        addPointId(pointIds, section.sectionIndex, indexInSection, point, newPointId);
 
         qDebug() << "  Point" << indexInSection << "inserted with id:" << newPointId
                  << "(old id:" << oldPointId << ")"
@@ -262,45 +424,28 @@ int64_t TubeRepository::insertPointWithPast(
     int indexInSection,
     int64_t pastPointId)
 {
-    QString query;
-
-    if (indexInSection == -1) {
-        // Интерполированная точка
-        if (pastPointId == -1) {
-            query = QString(
-                        "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z) "
-                        "VALUES (%1, %2, NULL, %3, %4, %5) "
-                        "RETURNING id"
-                        ).arg(sectionId).arg(verId).arg(point.x).arg(point.y).arg(point.z);
-        } else {
-            query = QString(
-                        "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z, past_point_id) "
-                        "VALUES (%1, %2, NULL, %3, %4, %5, %6) "
-                        "RETURNING id"
-                        ).arg(sectionId).arg(verId).arg(point.x).arg(point.y).arg(point.z).arg(pastPointId);
-        }
-    } else {
-        // Обычная точка сечения
-        if (pastPointId == -1) {
-            query = QString(
-                        "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z) "
-                        "VALUES (%1, %2, %3, %4, %5, %6) "
-                        "RETURNING id"
-                        ).arg(sectionId).arg(verId).arg(indexInSection).arg(point.x).arg(point.y).arg(point.z);
-        } else {
-            query = QString(
-                        "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z, past_point_id) "
-                        "VALUES (%1, %2, %3, %4, %5, %6, %7) "
-                        "RETURNING id"
-                        ).arg(sectionId).arg(verId).arg(indexInSection)
-                        .arg(point.x).arg(point.y).arg(point.z).arg(pastPointId);
-        }
+    QSqlQuery* query = db.getPreparedQuery(
+        "insert_point",
+        "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z, past_point_id) "
+        "VALUES (:section_id, :ver_id, :index_in_section, :x, :y, :z, :past_id) "
+        "RETURNING id");
+    if (!query) {
+        setLastError("Failed to prepare point insert: " + db.getLastError());
+        return -1;
     }
 
-    QSqlQuery result = db.executeQuery(query);
+    query->bindValue(":section_id", static_cast<qlonglong>(sectionId));
+    query->bindValue(":ver_id", verId);
+    // -1 - интерполированная точка, index_in_section = NULL
+    query->bindValue(":index_in_section", indexInSection == -1 ? QVariant(QMetaType::fromType<int>())
+                                                                   : QVariant(indexInSection));
+    query->bindValue(":x", static_cast<double>(point.x));
+    query->bindValue(":y", static_cast<double>(point.y));
+    query->bindValue(":z", static_cast<double>(point.z));
+    query->bindValue(":past_id", idOrNull(pastPointId));
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    if (db.executePrepared(*query) && query->next()) {
+        return query->value(0).toLongLong();
     }
 
     setLastError("Failed to get point id after insert");
@@ -312,23 +457,32 @@ bool TubeRepository::saveSegmentsWithVersioning(
     const Tube& tube,
     int verId,
     int64_t previousTubeId,
-    const std::map<PointKey, int64_t>& pointIdsMap,
-    const std::map<int64_t, int64_t>& oldPointIdToNewPointId)
+    const PointIdIndex& pointIds,
+    SaveMode mode)
 {
     qDebug() << "Saving" << tube.getSegmentCount() << "segments with versioning";
 
     // Загружаем старые сегменты если есть
-    std::map<int, int64_t> oldSegmentIndices;  // index -> segment_id
+    IdByIndex oldSegmentIndices;  // index -> segment_id
     if (previousTubeId != -1) {
-        QString query = QString(
-                            "SELECT id, index FROM segment WHERE tube_id = %1 ORDER BY index"
-                            ).arg(previousTubeId);
+        QSqlQuery* query = db.getPreparedQuery(
+            "select_segment_ids",
+            "SELECT id, \"index\" FROM segment WHERE tube_id = :tube_id ORDER BY \"index\"");
+        if (!query) {
+            setLastError("Failed to prepare segment lookup: " + db.getLastError());
+            return false;
+        }
 
-        QSqlQuery result = db.executeQuery(query);
-        while (result.next()) {
-            int64_t segmentId = result.value(0).toLongLong();
-            int index = result.value(1).toInt();
-            oldSegmentIndices[index] = segmentId;
+        query->bindValue(":tube_id", static_cast<qlonglong>(previousTubeId));
+        if (!db.executePrepared(*query)) {
+            setLastError("Failed to load old segments: " + db.getLastError());
+            return false;
+        }
+
+        while (query->next()) {
+            int64_t segmentId = query->value(0).toLongLong();
+            int index = query->value(1).toInt();
+            setIdAtIndex(oldSegmentIndices, index, segmentId);
         }
     }
 
@@ -337,10 +491,7 @@ bool TubeRepository::saveSegmentsWithVersioning(
         int segmentIndex = segment.segmentIndex;
 
         // Получаем старый segment_id если есть
-        int64_t oldSegmentId = -1;
-        if (oldSegmentIndices.find(segmentIndex) != oldSegmentIndices.end()) {
-            oldSegmentId = oldSegmentIndices[segmentIndex];
-        }
+        int64_t oldSegmentId = idAtIndex(oldSegmentIndices, segmentIndex);
 
         // Вставляем новый сегмент
         int64_t newSegmentId = insertSegmentWithPast(tubeId, segment, verId, segmentIndex, oldSegmentId);
@@ -352,18 +503,16 @@ bool TubeRepository::saveSegmentsWithVersioning(
 
         // Обновляем старый сегмент
         if (oldSegmentId != -1) {
-            QString updateQuery = QString(
-                                      "UPDATE segment SET future_segment_id = %1 WHERE id = %2"
-                                      ).arg(newSegmentId).arg(oldSegmentId);
-            db.executeQuery(updateQuery);
+            if (!setFutureId("segment", oldSegmentId, newSegmentId)) {
+                return false;
+            }
         }
 
         qDebug() << "Segment" << segmentIndex << "inserted with id:" << newSegmentId
                  << "(old id:" << oldSegmentId << ")";
 
         // Сохраняем рёбра
-        if (!saveEdgesWithVersioning(newSegmentId, oldSegmentId, segment, verId,
-                                     pointIdsMap, oldPointIdToNewPointId)) {
+        if (!saveEdgesWithVersioning(newSegmentId, oldSegmentId, segment, verId, pointIds, mode)) {
             setLastError(QString("Failed to save edges for segment %1: %2")
                              .arg(segmentIndex).arg(lastError));
             return false;
@@ -380,25 +529,23 @@ int64_t TubeRepository::insertSegmentWithPast(
     int index,
     int64_t pastSegmentId)
 {
-    QString query;
-    if (pastSegmentId == -1) {
-        query = QString(
-                    "INSERT INTO segment (tube_id, ver_id, index) "
-                    "VALUES (%1, %2, %3) "
-                    "RETURNING id"
-                    ).arg(tubeId).arg(verId).arg(index);
-    } else {
-        query = QString(
-                    "INSERT INTO segment (tube_id, ver_id, index, past_segment_id) "
-                    "VALUES (%1, %2, %3, %4) "
-                    "RETURNING id"
-                    ).arg(tubeId).arg(verId).arg(index).arg(pastSegmentId);
+    QSqlQuery* query = db.getPreparedQuery(
+        "insert_segment",
+        "INSERT INTO segment (tube_id, ver_id, \"index\", past_segment_id) "
+        "VALUES (:tube_id, :ver_id, :index, :past_id) "
+        "RETURNING id");
+    if (!query) {
+        setLastError("Failed to prepare segment insert: " + db.getLastError());
+        return -1;
     }
 
-    QSqlQuery result = db.executeQuery(query);
+    query->bindValue(":tube_id", static_cast<qlonglong>(tubeId));
+    query->bindValue(":ver_id", verId);
+    query->bindValue(":index", index);
+    query->bindValue(":past_id", idOrNull(pastSegmentId));
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    if (db.executePrepared(*query) && query->next()) {
+        return query->value(0).toLongLong();
     }
 
     setLastError("Failed to get segment id after insert");
@@ -410,50 +557,60 @@ bool TubeRepository::saveEdgesWithVersioning(
     int64_t oldSegmentId,
     const Segment& segment,
     int verId,
-    const std::map<PointKey, int64_t>& pointIdsMap,
-    const std::map<int64_t, int64_t>& oldPointIdToNewPointId)
+    const PointIdIndex& pointIds,
+    SaveMode mode)
 {
     qDebug() << "Saving" << segment.getConnectingEdgeCount() << "edges for segment id:" << newSegmentId;
 
     // Загружаем старые рёбра если есть
-    std::map<int, std::pair<int64_t, std::pair<int64_t, int64_t>>> oldEdges;
-    // index -> (edge_id, (start_point_id, end_point_id))
+    IdByIndex oldEdgeIds;  // index -> edge_id
 
     if (oldSegmentId != -1) {
-        QString query = QString(
-                            "SELECT id, index, start_point_id, end_point_id FROM edge "
-                            "WHERE segment_id = %1 ORDER BY index"
-                            ).arg(oldSegmentId);
+        QSqlQuery* query = db.getPreparedQuery(
+            "select_edge_ids",
+            "SELECT id, \"index\" FROM edge "
+            "WHERE segment_id = :segment_id ORDER BY \"index\"");
+        if (!query) {
+            setLastError("Failed to prepare edge lookup: " + db.getLastError());
+            return false;
+        }
 
-        QSqlQuery result = db.executeQuery(query);
-        while (result.next()) {
-            int64_t edgeId = result.value(0).toLongLong();
-            int index = result.value(1).toInt();
-            int64_t startPointId = result.value(2).toLongLong();
-            int64_t endPointId = result.value(3).toLongLong();
-            oldEdges[index] = std::make_pair(edgeId, std::make_pair(startPointId, endPointId));
+        query->bindValue(":segment_id", static_cast<qlonglong>(oldSegmentId));
+        if (!db.executePrepared(*query)) {
+            setLastError("Failed to load old edges: " + db.getLastError());
+            return false;
+        }
+
+        oldEdgeIds.assign(segment.getConnectingEdgeCount() + 1, -1);
+        while (query->next()) {
+            int64_t edgeId = query->value(0).toLongLong();
+            int index = query->value(1).toInt();
+            setIdAtIndex(oldEdgeIds, index, edgeId);
         }
     }
 
+    if (mode == SaveMode::Batched) {
+        return saveEdgesBatched(newSegmentId, segment, verId, oldEdgeIds, pointIds);
+    }
+
     for (size_t i = 0; i < segment.getConnectingEdgeCount(); ++i) {
         const Edge& edge = segment.getConnectingEdge(static_cast<int>(i + 1));
         int edgeIndex = edge.getIndex();
 
         // Находим ID точек для нового ребра
-        int64_t startPointId = findPointId(edge.getStartPoint(), pointIdsMap);
-        int64_t endPointId = findPointId(edge.getEndPoint(), pointIdsMap);
+        int64_t startPointId = findPointId(pointIds, edge.getStartSectionIndex(),
+                                           edge.getStartPointIndex(), edge.getStartPoint());
+        int64_t endPointId = findPointId(pointIds, edge.getEndSectionIndex(),
+                                         edge.getEndPointIndex(), edge.getEndPoint());
 
         // Если точки не найдены, это ошибка (все точки должны быть уже созданы)
         if (startPointId == -1 || endPointId == -1) {
-            qDebug() << "ERROR: Edge points not found in pointIdsMap for edge" << edgeIndex;
+            qDebug() << "ERROR: Edge points not found in pointIds for edge" << edgeIndex;
             return false;
         }
 
         // Получаем старое ребро если есть
-        int64_t oldEdgeId = -1;
-        if (oldEdges.find(edgeIndex) != oldEdges.end()) {
-            oldEdgeId = oldEdges[edgeIndex].first;
-        }
+        int64_t oldEdgeId = idAtIndex(oldEdgeIds, edgeIndex);
 
         // Вставляем новое ребро
         int64_t newEdgeId = insertEdgeWithPast(newSegmentId, edge, verId, edgeIndex,
@@ -466,10 +623,9 @@ bool TubeRepository::saveEdgesWithVersioning(
 
         // Обновляем старое ребро
         if (oldEdgeId != -1) {
-            QString updateQuery = QString(
-                                      "UPDATE edge SET future_edge_id = %1 WHERE id = %2"
-                                      ).arg(newEdgeId).arg(oldEdgeId);
-            db.executeQuery(updateQuery);
+            if (!setFutureId("edge", oldEdgeId, newEdgeId)) {
+                return false;
+            }
         }
 
         qDebug() << "  Edge" << edgeIndex << "inserted with id:" << newEdgeId
@@ -489,362 +645,1054 @@ int64_t TubeRepository::insertEdgeWithPast(
     int64_t endPointId,
     int64_t pastEdgeId)
 {
-    QString query;
-    if (pastEdgeId == -1) {
-        query = QString(
-                    "INSERT INTO edge (segment_id, ver_id, index, start_point_id, end_point_id, beg_sz) "
-                    "VALUES (%1, %2, %3, %4, %5, 100) "
-                    "RETURNING id"
-                    ).arg(segmentId).arg(verId).arg(index).arg(startPointId).arg(endPointId);
-    } else {
-        query = QString(
-                    "INSERT INTO edge (segment_id, ver_id, index, start_point_id, end_point_id, beg_sz, past_edge_id) "
-                    "VALUES (%1, %2, %3, %4, %5, 100, %6) "
-                    "RETURNING id"
-                    ).arg(segmentId).arg(verId).arg(index).arg(startPointId).arg(endPointId).arg(pastEdgeId);
+    QSqlQuery* query = db.getPreparedQuery(
+        "insert_edge",
+        "INSERT INTO edge (segment_id, ver_id, \"index\", start_point_id, end_point_id, beg_sz, past_edge_id) "
+        "VALUES (:segment_id, :ver_id, :index, :start_id, :end_id, 100, :past_id) "
+        "RETURNING id");
+    if (!query) {
+        setLastError("Failed to prepare edge insert: " + db.getLastError());
+        return -1;
     }
 
-    QSqlQuery result = db.executeQuery(query);
+    query->bindValue(":segment_id", static_cast<qlonglong>(segmentId));
+    query->bindValue(":ver_id", verId);
+    query->bindValue(":index", index);
+    query->bindValue(":start_id", static_cast<qlonglong>(startPointId));
+    query->bindValue(":end_id", static_cast<qlonglong>(endPointId));
+    query->bindValue(":past_id", idOrNull(pastEdgeId));
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    if (db.executePrepared(*query) && query->next()) {
+        return query->value(0).toLongLong();
     }
 
     setLastError("Failed to get edge id after insert");
     return -1;
 }
 
-int64_t TubeRepository::insertTubeRecord(int verId)
+bool TubeRepository::saveTubeBulk(int64_t tubeId, const Tube& tube, int verId, int64_t previousTubeId)
 {
-    QString query = QString(
-                        "INSERT INTO tube (ver_id, len) "
-                        "VALUES (%1, 0) "
-                        "RETURNING id"
-                        ).arg(verId);
+    const size_t sectionCount = tube.getSectionCount();
+    const size_t segmentCount = tube.getSegmentCount();
 
-    QSqlQuery result = db.executeQuery(query);
+    size_t pointCount = 0;
+    for (size_t i = 0; i < sectionCount; ++i) {
+        pointCount += tube.getSection(static_cast<int>(i + 1)).getPointCount();
+    }
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    size_t edgeCount = 0;
+    for (size_t i = 0; i < segmentCount; ++i) {
+        edgeCount += tube.getSegment(static_cast<int>(i + 1)).getConnectingEdgeCount();
     }
 
-    setLastError("Failed to get tube id after insert");
-    return -1;
-}
+    qDebug() << "Bulk save:" << sectionCount << "sections," << pointCount << "points,"
+             << segmentCount << "segments," << edgeCount << "edges";
 
-bool TubeRepository::saveSections(int64_t tubeId, const Tube& tube, int verId,
-                                  std::map<PointKey, int64_t>& pointIdsMap)
-{
-    qDebug() << "Saving" << tube.getSectionCount() << "sections";
+    // Старые id предыдущей версии: по одному запросу на таблицу
+    IdByIndex oldSectionIds;              // section index -> id
+    std::vector<IdByIndex> oldPointIds;   // [section index][index_in_section] -> id
+    IdByIndex oldSegmentIds;              // segment index -> id
+    std::vector<IdByIndex> oldEdgeIds;    // [segment index][edge index] -> id
 
-    for (size_t i = 0; i < tube.getSectionCount(); ++i) {
-        const Section& section = tube.getSection(static_cast<int>(i + 1));
+    if (previousTubeId != -1) {
+        oldPointIds.resize(sectionCount + 1);
+        oldEdgeIds.resize(segmentCount + 1);
 
-        int64_t sectionId = insertSection(tubeId, section, verId, section.sectionIndex);
-        if (sectionId == -1) {
-            setLastError(QString("Failed to insert section %1: %2")
-                             .arg(section.sectionIndex).arg(lastError));
+        if (!loadOldSectionIds(previousTubeId, oldSectionIds)) {
+            setLastError("Failed to load old section IDs");
             return false;
         }
 
-        qDebug() << "Section" << section.sectionIndex << "inserted with id:" << sectionId;
+        QSqlQuery pointResult = db.executeQuery(QString(
+                                                    "SELECT s.\"index\", p.index_in_section, p.id FROM point p "
+                                                    "JOIN section s ON p.section_id = s.id "
+                                                    "WHERE s.tube_id = %1 AND p.index_in_section IS NOT NULL"
+                                                    ).arg(previousTubeId));
+        while (pointResult.next()) {
+            const int sectionIndex = pointResult.value(0).toInt();
+            if (sectionIndex >= 0 && static_cast<size_t>(sectionIndex) < oldPointIds.size()) {
+                setIdAtIndex(oldPointIds[sectionIndex], pointResult.value(1).toInt(),
+                             pointResult.value(2).toLongLong());
+            }
+        }
+
+        QSqlQuery segmentResult = db.executeQuery(QString(
+                                                      "SELECT id, \"index\" FROM segment WHERE tube_id = %1"
+                                                      ).arg(previousTubeId));
+        while (segmentResult.next()) {
+            setIdAtIndex(oldSegmentIds, segmentResult.value(1).toInt(), segmentResult.value(0).toLongLong());
+        }
 
-        if (!savePoints(sectionId, section, verId, pointIdsMap)) {
-            setLastError(QString("Failed to save points for section %1: %2")
-                             .arg(section.sectionIndex).arg(lastError));
-            return false;
+        QSqlQuery edgeResult = db.executeQuery(QString(
+                                                   "SELECT g.\"index\", e.\"index\", e.id FROM edge e "
+                                                   "JOIN segment g ON e.segment_id = g.id "
+                                                   "WHERE g.tube_id = %1"
+                                                   ).arg(previousTubeId));
+        while (edgeResult.next()) {
+            const int segmentIndex = edgeResult.value(0).toInt();
+            if (segmentIndex >= 0 && static_cast<size_t>(segmentIndex) < oldEdgeIds.size()) {
+                setIdAtIndex(oldEdgeIds[segmentIndex], edgeResult.value(1).toInt(),
+                             edgeResult.value(2).toLongLong());
+            }
         }
     }
 
-    return true;
-}
+    // Резервируем id во всех последовательностях заранее
+    std::vector<int64_t> sectionIds = db.reserveSequenceIds("section", static_cast<int>(sectionCount));
+    std::vector<int64_t> pointIds = db.reserveSequenceIds("point", static_cast<int>(pointCount));
+    std::vector<int64_t> segmentIds = db.reserveSequenceIds("segment", static_cast<int>(segmentCount));
+    std::vector<int64_t> edgeIds = db.reserveSequenceIds("edge", static_cast<int>(edgeCount));
 
-int64_t TubeRepository::insertSection(int64_t tubeId, const Section& section,
-                                      int verId, int index)
-{
-    Point3D center = section.getCenter();
+    if (sectionIds.size() != sectionCount || pointIds.size() != pointCount ||
+        segmentIds.size() != segmentCount || edgeIds.size() != edgeCount) {
+        setLastError("Failed to reserve ids: " + db.getLastError());
+        return false;
+    }
 
-    QString query = QString(
-                        "INSERT INTO section (tube_id, ver_id, index, x_cen, y_cen, z_cen) "
-                        "VALUES (%1, %2, %3, %4, %5, %6) "
-                        "RETURNING id"
-                        ).arg(tubeId)
-                        .arg(verId)
-                        .arg(index)
-                        .arg(center.x)
-                        .arg(center.y)
-                        .arg(center.z);
+    // Сечения и точки
+    std::vector<int> sectionIndices;
+    std::vector<float> sectionX, sectionY, sectionZ;
+    std::vector<int64_t> sectionPast;
+    std::vector<int64_t> sectionLinkOld, sectionLinkNew;
+
+    std::vector<int64_t> pointSectionIds;
+    std::vector<int> pointIndices;
+    std::vector<float> pointX, pointY, pointZ;
+    std::vector<int64_t> pointPast;
+    std::vector<int64_t> pointLinkOld, pointLinkNew;
+
+    sectionIndices.reserve(sectionCount);
+    sectionX.reserve(sectionCount);
+    sectionY.reserve(sectionCount);
+    sectionZ.reserve(sectionCount);
+    sectionPast.reserve(sectionCount);
+    pointSectionIds.reserve(pointCount);
+    pointIndices.reserve(pointCount);
+    pointX.reserve(pointCount);
+    pointY.reserve(pointCount);
+    pointZ.reserve(pointCount);
+    pointPast.reserve(pointCount);
+
+    PointIdIndex newPointIds;
+    resetPointIdIndex(tube, newPointIds);
+
+    size_t pointCursor = 0;
+    for (size_t i = 0; i < sectionCount; ++i) {
+        const Section& section = tube.getSection(static_cast<int>(i + 1));
+        const int sectionIndex = section.sectionIndex;
+        const int64_t newSectionId = sectionIds[i];
+        const Point3D center = section.getCenter();
 
-    QSqlQuery result = db.executeQuery(query);
+        const int64_t oldSectionId = idAtIndex(oldSectionIds, sectionIndex);
+        if (oldSectionId != -1) {
+            sectionLinkOld.push_back(oldSectionId);
+            sectionLinkNew.push_back(newSectionId);
+        }
+
+        sectionIndices.push_back(sectionIndex);
+        sectionX.push_back(center.x);
+        sectionY.push_back(center.y);
+        sectionZ.push_back(center.z);
+        sectionPast.push_back(oldSectionId);
+
+        for (size_t j = 0; j < section.getPointCount(); ++j) {
+            const Point3D& point = section.getPoint(static_cast<int>(j + 1));
+            const int indexInSection = static_cast<int>(j + 1);
+            const int64_t newPointId = pointIds[pointCursor++];
+
+            int64_t oldPointId = -1;
+            if (oldSectionId != -1 && static_cast<size_t>(sectionIndex) < oldPointIds.size()) {
+                oldPointId = idAtIndex(oldPointIds[sectionIndex], indexInSection);
+                if (oldPointId != -1) {
+                    pointLinkOld.push_back(oldPointId);
+                    pointLinkNew.push_back(newPointId);
+                }
+            }
+
+            pointSectionIds.push_back(newSectionId);
+            pointIndices.push_back(indexInSection);
+            pointX.push_back(point.x);
+            pointY.push_back(point.y);
+            pointZ.push_back(point.z);
+            pointPast.push_back(oldPointId);
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+            addPointId(newPointIds, sectionIndex, indexInSection, point, newPointId);
+        }
     }
 
-    setLastError("Failed to get section id after insert");
-    return -1;
-}
+    // Сегменты и рёбра
+    std::vector<int> segmentIndices;
+    std::vector<int64_t> segmentPast;
+    std::vector<int64_t> segmentLinkOld, segmentLinkNew;
 
-bool TubeRepository::savePoints(int64_t sectionId, const Section& section, int verId,
-                                std::map<PointKey, int64_t>& pointIdsMap)
-{
-    qDebug() << "Saving" << section.getPointCount() << "points for section id:" << sectionId;
+    std::vector<int64_t> edgeSegmentIds;
+    std::vector<int> edgeIndices;
+    std::vector<int64_t> edgeStartIds, edgeEndIds;
+    std::vector<int64_t> edgePast;
+    std::vector<int64_t> edgeLinkOld, edgeLinkNew;
 
-    for (size_t i = 0; i < section.getPointCount(); ++i) {
-        const Point3D& point = section.getPoint(static_cast<int>(i + 1));
-        int indexInSection = static_cast<int>(i + 1);
+    segmentIndices.reserve(segmentCount);
+    segmentPast.reserve(segmentCount);
+    edgeSegmentIds.reserve(edgeCount);
+    edgeIndices.reserve(edgeCount);
+    edgeStartIds.reserve(edgeCount);
+    edgeEndIds.reserve(edgeCount);
+    edgePast.reserve(edgeCount);
 
-        int64_t pointId = insertPoint(sectionId, point, verId, indexInSection);
-        if (pointId == -1) {
-            setLastError(QString("Failed to insert point %1 in section: %2")
-                             .arg(indexInSection).arg(lastError));
-            return false;
-        }
+    size_t edgeCursor = 0;
+    for (size_t i = 0; i < segmentCount; ++i) {
+        const Segment& segment = tube.getSegment(static_cast<int>(i + 1));
+        const int segmentIndex = segment.segmentIndex;
+        const int64_t newSegmentId = segmentIds[i];
 
-        PointKey key = makePointKey(point);
-        pointIdsMap[key] = pointId;
+        const int64_t oldSegmentId = idAtIndex(oldSegmentIds, segmentIndex);
+        if (oldSegmentId != -1) {
+            segmentLinkOld.push_back(oldSegmentId);
+            segmentLinkNew.push_back(newSegmentId);
+        }
 
-        qDebug() << "  Point" << indexInSection << "inserted with id:" << pointId
-                 << "coords: (" << point.x << "," << point.y << "," << point.z << ")"
-                 << "pointIndex:" << point.pointIndex;
-    }
+        segmentIndices.push_back(segmentIndex);
+        segmentPast.push_back(oldSegmentId);
 
-    return true;
-}
+        for (size_t j = 0; j < segment.getConnectingEdgeCount(); ++j) {
+            const Edge& edge = segment.getConnectingEdge(static_cast<int>(j + 1));
+            const int edgeIndex = edge.getIndex();
+            const int64_t newEdgeId = edgeIds[edgeCursor++];
 
-int64_t TubeRepository::insertPoint(int64_t sectionId, const Point3D& point,
-                                    int verId, int indexInSection)
-{
-    QString query;
+            int64_t startPointId = findPointId(newPointIds, edge.getStartSectionIndex(),
+                                               edge.getStartPointIndex(), edge.getStartPoint());
+            int64_t endPointId = findPointId(newPointIds, edge.getEndSectionIndex(),
+                                             edge.getEndPointIndex(), edge.getEndPoint());
 
-    if (indexInSection == -1) {
-        query = QString(
-                    "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z) "
-                    "VALUES (%1, %2, NULL, %3, %4, %5) "
-                    "RETURNING id"
-                    ).arg(sectionId)
-                    .arg(verId)
-                    .arg(point.x)
-                    .arg(point.y)
-                    .arg(point.z);
-    } else {
-        query = QString(
-                    "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z) "
-                    "VALUES (%1, %2, %3, %4, %5, %6) "
-                    "RETURNING id"
-                    ).arg(sectionId)
-                    .arg(verId)
-                    .arg(indexInSection)
-                    .arg(point.x)
-                    .arg(point.y)
-                    .arg(point.z);
-    }
+            if (startPointId == -1 || endPointId == -1) {
+                qDebug() << "ERROR: Edge points not found in pointIds for edge" << edgeIndex;
+                setLastError(QString("Edge %1 of segment %2: points not found")
+                                 .arg(edgeIndex).arg(segmentIndex));
+                return false;
+            }
 
-    QSqlQuery result = db.executeQuery(query);
+            int64_t oldEdgeId = -1;
+            if (oldSegmentId != -1 && static_cast<size_t>(segmentIndex) < oldEdgeIds.size()) {
+                oldEdgeId = idAtIndex(oldEdgeIds[segmentIndex], edgeIndex);
+                if (oldEdgeId != -1) {
+                    edgeLinkOld.push_back(oldEdgeId);
+                    edgeLinkNew.push_back(newEdgeId);
+                }
+            }
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+            edgeSegmentIds.push_back(newSegmentId);
+            edgeIndices.push_back(edgeIndex);
+            edgeStartIds.push_back(startPointId);
+            edgeEndIds.push_back(endPointId);
+            edgePast.push_back(oldEdgeId);
+        }
     }
 
-    setLastError("Failed to get point id after insert");
-    return -1;
-}
-
-bool TubeRepository::saveSegments(int64_t tubeId, const Tube& tube, int verId,
-                                  const std::map<PointKey, int64_t>& pointIdsMap)
-{
-    qDebug() << "Saving" << tube.getSegmentCount() << "segments";
+    // Вставка: по одному запросу на таблицу
+    // Упакованный контур сечения (если включён) - одно значение bytea на сечение
+    QString contourArray;
+    if (packedGeometry) {
+        QStringList contours;
+        contours.reserve(static_cast<int>(sectionCount));
+        for (size_t i = 0; i < sectionCount; ++i) {
+            const QByteArray blob = packContour(tube.getSection(static_cast<int>(i + 1)));
+            contours.append(db.getBackend().blobLiteral(blob));
+        }
+        contourArray = QString("ARRAY[%1]::bytea[]").arg(contours.join(", "));
+    } else {
+        contourArray = QString("array_fill(NULL::bytea, ARRAY[%1])").arg(sectionCount);
+    }
+
+    QString sectionInsert = QString(
+                                "INSERT INTO section (id, tube_id, ver_id, \"index\", x_cen, y_cen, z_cen, past_section_id, contour) "
+                                "SELECT u.id, %1, %2, u.idx, u.x, u.y, u.z, u.past, u.contour "
+                                "FROM unnest(%3, %4, %5, %6, %7, %8, %9) AS u(id, idx, x, y, z, past, contour)"
+                                ).arg(tubeId).arg(verId)
+                                .arg(makeBigintArray(sectionIds), makeIntArray(sectionIndices),
+                                     makeRealArray(sectionX), makeRealArray(sectionY),
+                                     makeRealArray(sectionZ), makeBigintArray(sectionPast),
+                                     contourArray);
+    if (!db.execute(sectionInsert)) {
+        setLastError("Failed to insert sections: " + db.getLastError());
+        return false;
+    }
 
-    for (size_t i = 0; i < tube.getSegmentCount(); ++i) {
-        const Segment& segment = tube.getSegment(static_cast<int>(i + 1));
+    QString pointInsert = QString(
+                              "INSERT INTO point (id, section_id, ver_id, index_in_section, x, y, z, past_point_id) "
+                              "SELECT u.id, u.section_id, %1, u.idx, u.x, u.y, u.z, u.past "
+                              "FROM unnest(%2, %3, %4, %5, %6, %7, %8) AS u(id, section_id, idx, x, y, z, past)"
+                              ).arg(verId)
+                              .arg(makeBigintArray(pointIds), makeBigintArray(pointSectionIds),
+                                   makeIntArray(pointIndices), makeRealArray(pointX),
+                                   makeRealArray(pointY), makeRealArray(pointZ),
+                                   makeBigintArray(pointPast));
+    if (!db.execute(pointInsert)) {
+        setLastError("Failed to insert points: " + db.getLastError());
+        return false;
+    }
 
-        int64_t segmentId = insertSegment(tubeId, segment, verId, segment.segmentIndex);
-        if (segmentId == -1) {
-            setLastError(QString("Failed to insert segment %1: %2")
-                             .arg(segment.segmentIndex).arg(lastError));
-            return false;
-        }
+    QString segmentInsert = QString(
+                                "INSERT INTO segment (id, tube_id, ver_id, \"index\", past_segment_id) "
+                                "SELECT u.id, %1, %2, u.idx, u.past "
+                                "FROM unnest(%3, %4, %5) AS u(id, idx, past)"
+                                ).arg(tubeId).arg(verId)
+                                .arg(makeBigintArray(segmentIds), makeIntArray(segmentIndices),
+                                     makeBigintArray(segmentPast));
+    if (!db.execute(segmentInsert)) {
+        setLastError("Failed to insert segments: " + db.getLastError());
+        return false;
+    }
 
-        qDebug() << "Segment" << segment.segmentIndex << "inserted with id:" << segmentId;
+    QString edgeInsert = QString(
+                             "INSERT INTO edge (id, segment_id, ver_id, \"index\", start_point_id, end_point_id, beg_sz, past_edge_id) "
+                             "SELECT u.id, u.segment_id, %1, u.idx, u.start_id, u.end_id, 100, u.past "
+                             "FROM unnest(%2, %3, %4, %5, %6, %7) AS u(id, segment_id, idx, start_id, end_id, past)"
+                             ).arg(verId)
+                             .arg(makeBigintArray(edgeIds), makeBigintArray(edgeSegmentIds),
+                                  makeIntArray(edgeIndices), makeBigintArray(edgeStartIds),
+                                  makeBigintArray(edgeEndIds), makeBigintArray(edgePast));
+    if (!db.execute(edgeInsert)) {
+        setLastError("Failed to insert edges: " + db.getLastError());
+        return false;
+    }
 
-        if (!saveEdges(segmentId, segment, verId, pointIdsMap)) {
-            setLastError(QString("Failed to save edges for segment %1: %2")
-                             .arg(segment.segmentIndex).arg(lastError));
-            return false;
-        }
+    // Ссылки на будущее у предыдущей версии
+    if (!linkFutureIdsBulk("section", "future_section_id", sectionLinkOld, sectionLinkNew) ||
+        !linkFutureIdsBulk("point", "future_point_id", pointLinkOld, pointLinkNew) ||
+        !linkFutureIdsBulk("segment", "future_segment_id", segmentLinkOld, segmentLinkNew) ||
+        !linkFutureIdsBulk("edge", "future_edge_id", edgeLinkOld, edgeLinkNew)) {
+        return false;
     }
 
+    qDebug() << "Bulk save finished for tube id:" << tubeId;
     return true;
 }
 
-int64_t TubeRepository::insertSegment(int64_t tubeId, const Segment& segment,
-                                      int verId, int index)
+bool TubeRepository::linkFutureIdsBulk(const QString& table, const QString& futureColumn,
+                                       const std::vector<int64_t>& oldIds,
+                                       const std::vector<int64_t>& newIds)
 {
-    QString query = QString(
-                        "INSERT INTO segment (tube_id, ver_id, index) "
-                        "VALUES (%1, %2, %3) "
-                        "RETURNING id"
-                        ).arg(tubeId)
-                        .arg(verId)
-                        .arg(index);
+    if (oldIds.empty()) {
+        return true;
+    }
 
-    QSqlQuery result = db.executeQuery(query);
+    QString query = QString(
+                        "UPDATE %1 AS t SET %2 = m.new_id "
+                        "FROM unnest(%3, %4) AS m(old_id, new_id) "
+                        "WHERE t.id = m.old_id"
+                        ).arg(table, futureColumn, makeBigintArray(oldIds), makeBigintArray(newIds));
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    if (!db.execute(query)) {
+        setLastError(QString("Failed to link %1 versions: %2").arg(table).arg(db.getLastError()));
+        return false;
     }
 
-    setLastError("Failed to get segment id after insert");
-    return -1;
+    return true;
 }
 
-bool TubeRepository::saveEdges(int64_t segmentId, const Segment& segment, int verId,
-                               const std::map<PointKey, int64_t>& pointIdsMap)
+QString TubeRepository::makeBigintArray(const std::vector<int64_t>& values) const
 {
-    qDebug() << "Saving" << segment.getConnectingEdgeCount() << "edges for segment id:" << segmentId;
-
-    std::map<int, int64_t> sectionIndexToIdCache;
-
-    for (size_t i = 0; i < segment.getConnectingEdgeCount(); ++i) {
-        const Edge& edge = segment.getConnectingEdge(static_cast<int>(i + 1));
-
-        qDebug() << "  Processing edge" << edge.getIndex()
-                 << "start_section_idx:" << edge.getStartSectionIndex()
-                 << "start_point_idx:" << edge.getStartPointIndex()
-                 << "end_section_idx:" << edge.getEndSectionIndex()
-                 << "end_point_idx:" << edge.getEndPointIndex();
+    QStringList items;
+    items.reserve(static_cast<int>(values.size()));
+    for (int64_t value : values) {
+        // -1 означает отсутствие связи
+        items.append(value == -1 ? QString("NULL") : QString::number(value));
+    }
+    return QString("'{%1}'::bigint[]").arg(items.join(','));
+}
 
-        int64_t startPointId = findPointId(edge.getStartPoint(), pointIdsMap);
-        int64_t endPointId = findPointId(edge.getEndPoint(), pointIdsMap);
+QString TubeRepository::makeIntArray(const std::vector<int>& values) const
+{
+    QStringList items;
+    items.reserve(static_cast<int>(values.size()));
+    for (int value : values) {
+        items.append(QString::number(value));
+    }
+    return QString("'{%1}'::integer[]").arg(items.join(','));
+}
 
-        if (startPointId == -1) {
-            qDebug() << "    Start point not found in map, creating interpolated point";
+QString TubeRepository::makeRealArray(const std::vector<float>& values) const
+{
+    // 9 значащих цифр достаточно для точного восстановления float (real)
+    QStringList items;
+    items.reserve(static_cast<int>(values.size()));
+    for (float value : values) {
+        items.append(QString::number(static_cast<double>(value), 'g', 9));
+    }
+    return QString("'{%1}'::real[]").arg(items.join(','));
+}
 
-            int sectionIdx = edge.getStartSectionIndex();
-            if (sectionIdx < 1) {
-                setLastError(QString("Invalid start section index %1 for edge %2")
-                                 .arg(sectionIdx).arg(edge.getIndex()));
-                return false;
-            }
+bool TubeRepository::savePointsBatched(
+    int64_t newSectionId,
+    const Section& section,
+    int verId,
+    const IdByIndex& oldPointIndices,
+    PointIdIndex& pointIds)
+{
+    const int pointCount = static_cast<int>(section.getPointCount());
+    IdByIndex newIdsByIndex;
+
+    for (int batchStart = 1; batchStart <= pointCount; batchStart += insertBatchSize) {
+        const int rows = std::min(insertBatchSize, pointCount - batchStart + 1);
+
+        const QString sql =
+            "INSERT INTO point (section_id, ver_id, index_in_section, x, y, z, past_point_id) "
+            "VALUES " + makeValuesPlaceholders(rows, 7) + " "
+            "RETURNING id, index_in_section";
+
+        // В кэш соединения попадает только полная пачка, хвост готовится разово -
+        // иначе на каждое встреченное число строк оставался бы свой запрос на сервере
+        std::unique_ptr<QSqlQuery> tailQuery;
+        QSqlQuery* query = nullptr;
+        if (rows == insertBatchSize) {
+            query = db.getPreparedQuery(QString("insert_point_batch_%1").arg(rows), sql);
+        } else {
+            tailQuery = db.prepareQuery(sql);
+            query = tailQuery.get();
+        }
+        if (!query) {
+            setLastError("Failed to prepare point batch insert: " + db.getLastError());
+            return false;
+        }
 
-            int64_t sectionId;
-            if (sectionIndexToIdCache.find(sectionIdx) != sectionIndexToIdCache.end()) {
-                sectionId = sectionIndexToIdCache[sectionIdx];
-            } else {
-                QString findSectionQuery = QString(
-                                               "SELECT id FROM section WHERE tube_id = "
-                                               "(SELECT tube_id FROM segment WHERE id = %1) "
-                                               "AND index = %2"
-                                               ).arg(segmentId).arg(sectionIdx);
-
-                QSqlQuery sectionResult = db.executeQuery(findSectionQuery);
-                if (!sectionResult.next()) {
-                    setLastError(QString("Failed to find section %1 for interpolated start point")
-                                     .arg(sectionIdx));
-                    return false;
-                }
+        int pos = 0;
+        for (int indexInSection = batchStart; indexInSection < batchStart + rows; ++indexInSection) {
+            const Point3D& point = section.getPoint(indexInSection);
 
-                sectionId = sectionResult.value(0).toLongLong();
-                sectionIndexToIdCache[sectionIdx] = sectionId;
-            }
+            int64_t oldPointId = idAtIndex(oldPointIndices, indexInSection);
 
-            startPointId = insertPoint(sectionId, edge.getStartPoint(), verId, -1);
+            query->bindValue(pos++, static_cast<qlonglong>(newSectionId));
+            query->bindValue(pos++, verId);
+            query->bindValue(pos++, indexInSection);
+            query->bindValue(pos++, static_cast<double>(point.x));
+            query->bindValue(pos++, static_cast<double>(point.y));
+            query->bindValue(pos++, static_cast<double>(point.z));
+            query->bindValue(pos++, idOrNull(oldPointId));
+        }
 
-            if (startPointId == -1) {
-                setLastError("Failed to insert interpolated start point");
-                return false;
-            }
+        if (!db.executePrepared(*query)) {
+            setLastError("Failed to insert point batch: " + db.getLastError());
+            return false;
+        }
 
-            qDebug() << "    Interpolated start point inserted with id:" << startPointId;
+        // RETURNING не гарантирует порядок строк - сопоставляем по index_in_section
+        newIdsByIndex.assign(batchStart + rows, -1);
+        int returned = 0;
+        while (query->next()) {
+            ++returned;
+            setIdAtIndex(newIdsByIndex, query->value(1).toInt(), query->value(0).toLongLong());
         }
 
-        if (endPointId == -1) {
-            qDebug() << "    End point not found in map, creating interpolated point";
+        if (returned != rows) {
+            setLastError(QString("Point batch returned %1 ids, expected %2").arg(returned).arg(rows));
+            return false;
+        }
 
-            int sectionIdx = edge.getEndSectionIndex();
-            if (sectionIdx < 1) {
-                setLastError(QString("Invalid end section index %1 for edge %2")
-                                 .arg(sectionIdx).arg(edge.getIndex()));
+        std::vector<int64_t> linkOld, linkNew;
+        for (int indexInSection = batchStart; indexInSection < batchStart + rows; ++indexInSection) {
+            int64_t newPointId = idAtIndex(newIdsByIndex, indexInSection);
+            if (newPointId == -1) {
+                setLastError(QString("Point batch did not return id for point %1").arg(indexInSection));
                 return false;
             }
 
-            int64_t sectionId;
-            if (sectionIndexToIdCache.find(sectionIdx) != sectionIndexToIdCache.end()) {
-                sectionId = sectionIndexToIdCache[sectionIdx];
-            } else {
-                QString findSectionQuery = QString(
-                                               "SELECT id FROM section WHERE tube_id = "
-                                               "(SELECT tube_id FROM segment WHERE id = %1) "
-                                               "AND index = %2"
-                                               ).arg(segmentId).arg(sectionIdx);
-
-                QSqlQuery sectionResult = db.executeQuery(findSectionQuery);
-                if (!sectionResult.next()) {
-                    setLastError(QString("Failed to find section %1 for interpolated end point")
-                                     .arg(sectionIdx));
-                    return false;
-                }
-
-                sectionId = sectionResult.value(0).toLongLong();
-                sectionIndexToIdCache[sectionIdx] = sectionId;
-            }
-
-            endPointId = insertPoint(sectionId, edge.getEndPoint(), verId, -1);
-
-            if (endPointId == -1) {
-                setLastError("Failed to insert interpolated end point");
-                return false;
+            int64_t oldPointId = idAtIndex(oldPointIndices, indexInSection);
+            if (oldPointId != -1) {
+                linkOld.push_back(oldPointId);
+                linkNew.push_back(newPointId);
             }
 
-            qDebug() << "    Interpolated end point inserted with id:" << endPointId;
+            addPointId(pointIds, section.sectionIndex, indexInSection,
+                       section.getPoint(indexInSection), newPointId);
         }
 
-        int64_t edgeId = insertEdge(segmentId, edge, verId, edge.getIndex(),
-                                    startPointId, endPointId);
-        if (edgeId == -1) {
-            setLastError(QString("Failed to insert edge %1: %2")
-                             .arg(edge.getIndex()).arg(lastError));
+        if (!linkFutureIdsBulk("point", "future_point_id", linkOld, linkNew)) {
             return false;
         }
 
-        qDebug() << "  Edge" << edge.getIndex() << "inserted with id:" << edgeId
-                 << "(start_point_id:" << startPointId << ", end_point_id:" << endPointId << ")";
+        qDebug() << "  Point batch" << batchStart << "-" << (batchStart + rows - 1)
+                 << "inserted for section id:" << newSectionId;
     }
 
     return true;
 }
 
-int64_t TubeRepository::insertEdge(int64_t segmentId, const Edge& edge, int verId,
-                                   int index, int64_t startPointId, int64_t endPointId)
+bool TubeRepository::saveEdgesBatched(
+    int64_t newSegmentId,
+    const Segment& segment,
+    int verId,
+    const IdByIndex& oldEdgeIds,
+    const PointIdIndex& pointIds)
 {
+    const int edgeCount = static_cast<int>(segment.getConnectingEdgeCount());
+    IdByIndex oldIdsByIndex;  // edge index -> old edge id (только рёбра текущей пачки)
+
+    for (int batchStart = 1; batchStart <= edgeCount; batchStart += insertBatchSize) {
+        const int rows = std::min(insertBatchSize, edgeCount - batchStart + 1);
+
+        const QString sql =
+            "INSERT INTO edge (segment_id, ver_id, \"index\", start_point_id, end_point_id, beg_sz, past_edge_id) "
+            "VALUES " + makeValuesPlaceholders(rows, 7) + " "
+            "RETURNING id, \"index\"";
+
+        // Как и для точек: кэшируется только полная пачка
+        std::unique_ptr<QSqlQuery> tailQuery;
+        QSqlQuery* query = nullptr;
+        if (rows == insertBatchSize) {
+            query = db.getPreparedQuery(QString("insert_edge_batch_%1").arg(rows), sql);
+        } else {
+            tailQuery = db.prepareQuery(sql);
+            query = tailQuery.get();
+        }
+        if (!query) {
+            setLastError("Failed to prepare edge batch insert: " + db.getLastError());
+            return false;
+        }
+
+        oldIdsByIndex.clear();
+        int pos = 0;
+        for (int i = batchStart; i < batchStart + rows; ++i) {
+            const Edge& edge = segment.getConnectingEdge(i);
+            int edgeIndex = edge.getIndex();
+
+            int64_t startPointId = findPointId(pointIds, edge.getStartSectionIndex(),
+                                               edge.getStartPointIndex(), edge.getStartPoint());
+            int64_t endPointId = findPointId(pointIds, edge.getEndSectionIndex(),
+                                             edge.getEndPointIndex(), edge.getEndPoint());
+
+            if (startPointId == -1 || endPointId == -1) {
+                qDebug() << "ERROR: Edge points not found in pointIds for edge" << edgeIndex;
+                return false;
+            }
+
+            int64_t oldEdgeId = idAtIndex(oldEdgeIds, edgeIndex);
+            if (oldEdgeId != -1) {
+                setIdAtIndex(oldIdsByIndex, edgeIndex, oldEdgeId);
+            }
+
+            query->bindValue(pos++, static_cast<qlonglong>(newSegmentId));
+            query->bindValue(pos++, verId);
+            query->bindValue(pos++, edgeIndex);
+            query->bindValue(pos++, static_cast<qlonglong>(startPointId));
+            query->bindValue(pos++, static_cast<qlonglong>(endPointId));
+            query->bindValue(pos++, 100.0);
+            query->bindValue(pos++, idOrNull(oldEdgeId));
+        }
+
+        if (!db.executePrepared(*query)) {
+            setLastError("Failed to insert edge batch: " + db.getLastError());
+            return false;
+        }
+
+        std::vector<int64_t> linkOld, linkNew;
+        int returned = 0;
+        while (query->next()) {
+            ++returned;
+            int64_t oldEdgeId = idAtIndex(oldIdsByIndex, query->value(1).toInt());
+            if (oldEdgeId != -1) {
+                linkOld.push_back(oldEdgeId);
+                linkNew.push_back(query->value(0).toLongLong());
+            }
+        }
 
+        if (returned != rows) {
+            setLastError(QString("Edge batch returned %1 ids, expected %2").arg(returned).arg(rows));
+            return false;
+        }
+
+        if (!linkFutureIdsBulk("edge", "future_edge_id", linkOld, linkNew)) {
+            return false;
+        }
+
+        qDebug() << "  Edge batch" << batchStart << "-" << (batchStart + rows - 1)
+                 << "inserted for segment id:" << newSegmentId;
+    }
+
+    return true;
+}
+
+QString TubeRepository::makeValuesPlaceholders(int rows, int columns) const
+{
+    QStringList row;
+    for (int c = 0; c < columns; ++c) {
+        row.append("?");
+    }
+    const QString rowText = "(" + row.join(", ") + ")";
+
+    QStringList values;
+    values.reserve(rows);
+    for (int r = 0; r < rows; ++r) {
+        values.append(rowText);
+    }
+    return values.join(", ");
+}
+
+void TubeRepository::setVersionStorage(VersionStorage storage)
+{
+    versionStorage = storage;
+}
+
+void TubeRepository::setDeltaEpsilon(float epsilon)
+{
+    deltaEpsilon = std::max(0.0f, epsilon);
+}
+
+void TubeRepository::setKeyframeInterval(int interval)
+{
+    keyframeInterval = std::max(0, interval);
+}
+
+int TubeRepository::getDeltaChainDepth(int64_t tubeId)
+{
+    // Число дельта-версий от tubeId назад до ближайшего снимка (0 - сама версия снимок)
     QString query = QString(
-                        "INSERT INTO edge (segment_id, ver_id, index, start_point_id, end_point_id) "
-                        "VALUES (%1, %2, %3, %4, %5) "
-                        "RETURNING id"
-                        ).arg(segmentId)
-                        .arg(verId)
-                        .arg(index)
-                        .arg(startPointId)
-                        .arg(endPointId);
+                        "WITH RECURSIVE chain AS ( "
+                        "  SELECT id, base_tube_id, storage_kind FROM tube WHERE id = %1 "
+                        "  UNION ALL "
+                        "  SELECT t.id, t.base_tube_id, t.storage_kind "
+                        "  FROM tube t JOIN chain c ON t.id = c.base_tube_id "
+                        "  WHERE c.storage_kind = %2 "
+                        ") "
+                        "SELECT count(*) FILTER (WHERE storage_kind = %2), "
+                        "       count(*) FILTER (WHERE storage_kind = %3) "
+                        "FROM chain"
+                        ).arg(tubeId).arg(STORAGE_DELTA).arg(STORAGE_SNAPSHOT);
 
     QSqlQuery result = db.executeQuery(query);
+    if (!result.next() || result.value(1).toInt() != 1) {
+        setLastError(QString("Failed to resolve delta chain of tube %1").arg(tubeId));
+        return -1;
+    }
 
-    if (result.next()) {
-        return result.value(0).toLongLong();
+    return result.value(0).toInt();
+}
+
+int64_t TubeRepository::getSnapshotTubeId(int64_t tubeId)
+{
+    QString query = QString(
+                        "WITH RECURSIVE chain AS ( "
+                        "  SELECT id, base_tube_id, storage_kind FROM tube WHERE id = %1 "
+                        "  UNION ALL "
+                        "  SELECT t.id, t.base_tube_id, t.storage_kind "
+                        "  FROM tube t JOIN chain c ON t.id = c.base_tube_id "
+                        "  WHERE c.storage_kind = %2 "
+                        ") "
+                        "SELECT id FROM chain WHERE storage_kind = %3"
+                        ).arg(tubeId).arg(STORAGE_DELTA).arg(STORAGE_SNAPSHOT);
+
+    QSqlQuery result = db.executeQuery(query);
+    if (!result.next()) {
+        setLastError(QString("Failed to resolve base snapshot of tube %1").arg(tubeId));
+        return -1;
     }
 
-    setLastError("Failed to get edge id after insert");
+    return result.value(0).toLongLong();
+}
+
+bool TubeRepository::collectPointDeltas(const Tube& baseTube, const Tube& tube,
+                                        std::vector<PointDelta>& deltas) const
+{
+    deltas.clear();
+
+    auto moved = [this](const Point3D& a, const Point3D& b) {
+        return std::fabs(a.x - b.x) > deltaEpsilon ||
+               std::fabs(a.y - b.y) > deltaEpsilon ||
+               std::fabs(a.z - b.z) > deltaEpsilon;
+    };
+
+    if (baseTube.getSectionCount() != tube.getSectionCount() ||
+        baseTube.getSegmentCount() != tube.getSegmentCount()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < tube.getSectionCount(); ++i) {
+        const Section& baseSection = baseTube.getSection(static_cast<int>(i + 1));
+        const Section& section = tube.getSection(static_cast<int>(i + 1));
+
+        if (baseSection.getPointCount() != section.getPointCount()) {
+            return false;
+        }
+
+        for (size_t j = 0; j < section.getPointCount(); ++j) {
+            const Point3D& point = section.getPoint(static_cast<int>(j + 1));
+            if (moved(baseSection.getPoint(static_cast<int>(j + 1)), point)) {
+                deltas.push_back({static_cast<int>(i + 1), static_cast<int>(j + 1), point});
+            }
+        }
+    }
+
+    // Рёбра берутся из базовой версии, поэтому их связи должны совпадать,
+    // а интерполированные концы (не принадлежащие сечениям) - не сдвигаться
+    for (size_t i = 0; i < tube.getSegmentCount(); ++i) {
+        const Segment& baseSegment = baseTube.getSegment(static_cast<int>(i + 1));
+        const Segment& segment = tube.getSegment(static_cast<int>(i + 1));
+
+        if (baseSegment.getStartSectionIndex() != segment.getStartSectionIndex() ||
+            baseSegment.getEndSectionIndex() != segment.getEndSectionIndex() ||
+            baseSegment.getConnectingEdgeCount() != segment.getConnectingEdgeCount()) {
+            return false;
+        }
+
+        for (size_t j = 0; j < segment.getConnectingEdgeCount(); ++j) {
+            const Edge& baseEdge = baseSegment.getConnectingEdge(static_cast<int>(j + 1));
+            const Edge& edge = segment.getConnectingEdge(static_cast<int>(j + 1));
+
+            if (baseEdge.getStartSectionIndex() != edge.getStartSectionIndex() ||
+                baseEdge.getEndSectionIndex() != edge.getEndSectionIndex() ||
+                baseEdge.getStartPointIndex() != edge.getStartPointIndex() ||
+                baseEdge.getEndPointIndex() != edge.getEndPointIndex()) {
+                return false;
+            }
+
+            if (!edge.isStartPointFromSection() && moved(baseEdge.getStartPoint(), edge.getStartPoint())) {
+                return false;
+            }
+            if (!edge.isEndPointFromSection() && moved(baseEdge.getEndPoint(), edge.getEndPoint())) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int64_t TubeRepository::saveTubeDelta(int verId, int64_t baseTubeId,
+                                      const std::vector<PointDelta>& deltas,
+                                      const Tube& storedTube)
+{
+    qDebug() << "Saving tube as delta of" << baseTubeId << "with" << deltas.size() << "changed points";
+
+    if (!db.beginTransaction()) {
+        setLastError("Failed to begin transaction: " + db.getLastError());
+        return -1;
+    }
+
+    // Длина трубки совпадает с базовой: рёбра общие
+    QSqlQuery* tubeQuery = db.getPreparedQuery(
+        "insert_delta_tube",
+        QString("INSERT INTO tube (ver_id, len, storage_kind, base_tube_id) "
+                "SELECT :ver_id, len, %1, id FROM tube WHERE id = :base_id "
+                "RETURNING id").arg(STORAGE_DELTA));
+    if (!tubeQuery) {
+        db.rollbackTransaction();
+        setLastError("Failed to prepare delta tube insert: " + db.getLastError());
+        return -1;
+    }
+
+    tubeQuery->bindValue(":ver_id", verId);
+    tubeQuery->bindValue(":base_id", static_cast<qlonglong>(baseTubeId));
+
+    if (!db.executePrepared(*tubeQuery) || !tubeQuery->next()) {
+        db.rollbackTransaction();
+        setLastError("Failed to insert delta tube record: " + db.getLastError());
+        return -1;
+    }
+
+    int64_t tubeId = tubeQuery->value(0).toLongLong();
+
+    if (!deltas.empty()) {
+        std::vector<int> sectionIndices, pointIndices;
+        std::vector<float> xs, ys, zs;
+        sectionIndices.reserve(deltas.size());
+        pointIndices.reserve(deltas.size());
+        xs.reserve(deltas.size());
+        ys.reserve(deltas.size());
+        zs.reserve(deltas.size());
+
+        for (const PointDelta& delta : deltas) {
+            sectionIndices.push_back(delta.sectionIndex);
+            pointIndices.push_back(delta.indexInSection);
+            xs.push_back(delta.point.x);
+            ys.push_back(delta.point.y);
+            zs.push_back(delta.point.z);
+        }
+
+        QString deltaInsert = QString(
+                                  "INSERT INTO point_delta (tube_id, section_index, index_in_section, x, y, z) "
+                                  "SELECT %1, u.s, u.i, u.x, u.y, u.z "
+                                  "FROM unnest(%2, %3, %4, %5, %6) AS u(s, i, x, y, z)"
+                                  ).arg(tubeId)
+                                  .arg(makeIntArray(sectionIndices), makeIntArray(pointIndices),
+                                       makeRealArray(xs), makeRealArray(ys), makeRealArray(zs));
+
+        if (!db.execute(deltaInsert)) {
+            db.rollbackTransaction();
+            setLastError("Failed to insert point deltas: " + db.getLastError());
+            return -1;
+        }
+    }
+
+    // Центры всех сечений версии для пространственных запросов: своих строк section
+    // у дельты нет, а центры сдвинутых сечений отличаются от центров снимка
+    int64_t snapshotId = getSnapshotTubeId(baseTubeId);
+    if (snapshotId == -1) {
+        db.rollbackTransaction();
+        return -1;
+    }
+
+    const size_t sectionCount = storedTube.getSectionCount();
+    std::vector<int> sectionIndices;
+    std::vector<float> xs, ys, zs;
+    sectionIndices.reserve(sectionCount);
+    xs.reserve(sectionCount);
+    ys.reserve(sectionCount);
+    zs.reserve(sectionCount);
+
+    for (size_t i = 0; i < sectionCount; ++i) {
+        const Section& section = storedTube.getSection(static_cast<int>(i + 1));
+        const Point3D center = section.getCenter();
+        sectionIndices.push_back(section.sectionIndex);
+        xs.push_back(center.x);
+        ys.push_back(center.y);
+        zs.push_back(center.z);
+    }
+
+    QString centerInsert = QString(
+                               "INSERT INTO delta_section_center (tube_id, section_id, \"index\", x_cen, y_cen, z_cen) "
+                               "SELECT %1, s.id, u.i, u.x, u.y, u.z "
+                               "FROM unnest(%2, %3, %4, %5) AS u(i, x, y, z) "
+                               "JOIN section s ON s.tube_id = %6 AND s.\"index\" = u.i"
+                               ).arg(tubeId)
+                               .arg(makeIntArray(sectionIndices), makeRealArray(xs),
+                                    makeRealArray(ys), makeRealArray(zs))
+                               .arg(snapshotId);
+
+    if (!db.execute(centerInsert)) {
+        db.rollbackTransaction();
+        setLastError("Failed to insert delta section centers: " + db.getLastError());
+        return -1;
+    }
+
+    if (!db.commitTransaction()) {
+        db.rollbackTransaction();
+        setLastError("Failed to commit transaction: " + db.getLastError());
+        return -1;
+    }
+
+    qDebug() << "TubeRepository::saveTube - Tube saved successfully (delta) with id:" << tubeId;
+    return tubeId;
+}
+
+void TubeRepository::applyPointDeltas(Tube& tube, const std::vector<PointDelta>& deltas)
+{
+    for (const PointDelta& delta : deltas) {
+        tube.getSection(delta.sectionIndex).getPoint(delta.indexInSection) = delta.point;
+    }
+
+    // Как и при загрузке цепочки: концы рёбер на сечениях следуют за точками
+    tube.updateSegmentGeometry();
+}
+
+void TubeRepository::setPackedGeometry(bool enabled)
+{
+    packedGeometry = enabled;
+}
+
+void TubeRepository::setDeferLengthUpdates(bool enabled)
+{
+    deferLengthUpdates = enabled;
+}
+
+QByteArray TubeRepository::packContour(const Section& section) const
+{
+    // x, y, z каждой точки подряд как little-endian float32
+    QByteArray blob(static_cast<int>(section.getPointCount() * 3 * sizeof(float)), '\0');
+    char* out = blob.data();
+
+    for (size_t i = 0; i < section.getPointCount(); ++i) {
+        const Point3D& point = section.getPoint(static_cast<int>(i + 1));
+        qToLittleEndian<float>(point.x, out);
+        qToLittleEndian<float>(point.y, out + sizeof(float));
+        qToLittleEndian<float>(point.z, out + 2 * sizeof(float));
+        out += 3 * sizeof(float);
+    }
+
+    return blob;
+}
+
+bool TubeRepository::unpackContour(const QByteArray& blob, Section& section) const
+{
+    const int pointSize = static_cast<int>(3 * sizeof(float));
+    if (blob.isEmpty() || blob.size() % pointSize != 0) {
+        return false;
+    }
+
+    const char* in = blob.constData();
+    for (int i = 0; i < blob.size() / pointSize; ++i) {
+        Point3D p;
+        p.x = qFromLittleEndian<float>(in);
+        p.y = qFromLittleEndian<float>(in + sizeof(float));
+        p.z = qFromLittleEndian<float>(in + 2 * sizeof(float));
+        section.addPoint(p);
+        in += pointSize;
+    }
+
+    return true;
+}
+
+bool TubeRepository::readTubeHeader(int64_t tubeId, int& verId, int& storageKind)
+{
+    QString tubeQuery = QString("SELECT ver_id, storage_kind FROM tube WHERE id = %1").arg(tubeId);
+    QSqlQuery tubeResult = db.executeQuery(tubeQuery);
+    if (!tubeResult.next()) {
+        setLastError(QString("Tube with id %1 not found").arg(tubeId));
+        return false;
+    }
+
+    verId = tubeResult.value(0).toInt();
+    storageKind = tubeResult.value(1).toInt();
+    return true;
+}
+
+bool TubeRepository::loadDeltaChain(int64_t tubeId, Tube& tube)
+{
+    // Цепочка base_tube_id от запрошенной версии до ближайшего полного снимка
+    QString chainQuery = QString(
+                             "WITH RECURSIVE chain AS ( "
+                             "  SELECT id, base_tube_id, storage_kind, 0 AS depth FROM tube WHERE id = %1 "
+                             "  UNION ALL "
+                             "  SELECT t.id, t.base_tube_id, t.storage_kind, c.depth + 1 "
+                             "  FROM tube t JOIN chain c ON t.id = c.base_tube_id "
+                             "  WHERE c.storage_kind = %2 "
+                             ") "
+                             "SELECT id, storage_kind FROM chain ORDER BY depth DESC"
+                             ).arg(tubeId).arg(STORAGE_DELTA);
+
+    QSqlQuery chainResult = db.executeQuery(chainQuery);
+
+    int64_t snapshotId = -1;
+    std::vector<int64_t> deltaIds;  // от старых к новым
+    while (chainResult.next()) {
+        if (snapshotId == -1) {
+            if (chainResult.value(1).toInt() != STORAGE_SNAPSHOT) {
+                break;
+            }
+            snapshotId = chainResult.value(0).toLongLong();
+        } else {
+            deltaIds.push_back(chainResult.value(0).toLongLong());
+        }
+    }
+
+    if (snapshotId == -1 || deltaIds.empty()) {
+        setLastError(QString("Delta chain of tube %1 does not end in a snapshot").arg(tubeId));
+        return false;
+    }
+
+    qDebug() << "Reconstructing tube" << tubeId << "from snapshot" << snapshotId
+             << "and" << deltaIds.size() << "deltas";
+
+    if (!loadSnapshotBatched(snapshotId, tube)) {
+        return false;
+    }
+
+    // Все дельты цепочки одним запросом, в порядке от старых к новым
+    QString idArray = makeBigintArray(deltaIds);
+    QString deltaQuery = QString(
+                             "SELECT section_index, index_in_section, x, y, z FROM point_delta "
+                             "WHERE tube_id = ANY(%1) "
+                             "ORDER BY array_position(%1, tube_id)"
+                             ).arg(idArray);
+
+    QSqlQuery deltaResult = db.executeQuery(deltaQuery);
+
+    int applied = 0;
+    while (deltaResult.next()) {
+        int sectionIndex = deltaResult.value(0).toInt();
+        int indexInSection = deltaResult.value(1).toInt();
+
+        if (sectionIndex < 1 || sectionIndex > static_cast<int>(tube.getSectionCount())) {
+            setLastError(QString("Point delta references missing section %1").arg(sectionIndex));
+            return false;
+        }
+
+        Section& section = tube.getSection(sectionIndex);
+        if (indexInSection < 1 || indexInSection > static_cast<int>(section.getPointCount())) {
+            setLastError(QString("Point delta references missing point %1 in section %2")
+                             .arg(indexInSection).arg(sectionIndex));
+            return false;
+        }
+
+        Point3D& point = section.getPoint(indexInSection);
+        point.x = deltaResult.value(2).toFloat();
+        point.y = deltaResult.value(3).toFloat();
+        point.z = deltaResult.value(4).toFloat();
+        ++applied;
+    }
+
+    // Концы рёбер, лежащие на сечениях, следуют за сдвинутыми точками
+    tube.updateSegmentGeometry();
+
+    qDebug() << "Applied" << applied << "point deltas";
+    return true;
+}
+
+int64_t TubeRepository::insertTubeRecord(int verId)
+{
+    QSqlQuery* query = db.getPreparedQuery(
+        "insert_tube",
+        "INSERT INTO tube (ver_id, len) VALUES (:ver_id, 0) RETURNING id");
+    if (!query) {
+        setLastError("Failed to prepare tube insert: " + db.getLastError());
+        return -1;
+    }
+
+    query->bindValue(":ver_id", verId);
+
+    if (db.executePrepared(*query) && query->next()) {
+        return query->value(0).toLongLong();
+    }
+
+    setLastError("Failed to get tube id after insert");
     return -1;
 }
 
-int64_t TubeRepository::findPointId(const Point3D& point,
-                                    const std::map<PointKey, int64_t>& pointIdsMap) const
+void TubeRepository::resetPointIdIndex(const Tube& tube, PointIdIndex& pointIds) const
 {
-    PointKey key = makePointKey(point);
+    const size_t sectionCount = tube.getSectionCount();
+    size_t pointCount = 0;
 
-    auto it = pointIdsMap.find(key);
-    if (it != pointIdsMap.end()) {
+    pointIds.bySection.assign(sectionCount + 1, IdByIndex());
+    for (size_t i = 0; i < sectionCount; ++i) {
+        const Section& section = tube.getSection(static_cast<int>(i + 1));
+        if (section.sectionIndex >= 0 && static_cast<size_t>(section.sectionIndex) <= sectionCount) {
+            pointIds.bySection[section.sectionIndex].assign(section.getPointCount() + 1, -1);
+        }
+        pointCount += section.getPointCount();
+    }
+
+    pointIds.byCoordinates.clear();
+    pointIds.byCoordinates.reserve(pointCount);
+    pointIds.count = 0;
+}
+
+void TubeRepository::addPointId(PointIdIndex& pointIds, int sectionIndex, int indexInSection,
+                                const Point3D& point, int64_t id) const
+{
+    if (sectionIndex >= 0 && indexInSection >= 0) {
+        if (pointIds.bySection.size() <= static_cast<size_t>(sectionIndex)) {
+            pointIds.bySection.resize(sectionIndex + 1);
+        }
+        setIdAtIndex(pointIds.bySection[sectionIndex], indexInSection, id);
+    }
+
+    pointIds.byCoordinates[makePointKey(point)] = id;
+    pointIds.count++;
+}
+
+int64_t TubeRepository::findPointId(const PointIdIndex& pointIds, int sectionIndex,
+                                    int indexInSection, const Point3D& point) const
+{
+    // Точка контура - прямой доступ по индексам
+    if (sectionIndex >= 0 && indexInSection >= 1
+        && static_cast<size_t>(sectionIndex) < pointIds.bySection.size()) {
+        int64_t id = idAtIndex(pointIds.bySection[sectionIndex], indexInSection);
+        if (id != -1) {
+            return id;
+        }
+    }
+
+    auto it = pointIds.byCoordinates.find(makePointKey(point));
+    if (it != pointIds.byCoordinates.end()) {
         return it->second;
     }
 
@@ -910,17 +1758,73 @@ void TubeRepository::setLastError(const QString& error)
 
 TubeRepository::PointKey TubeRepository::makePointKey(const Point3D& point) const
 {
+    PointKey key;
+    key.x = std::llround(point.x / POINT_KEY_STEP);
+    key.y = std::llround(point.y / POINT_KEY_STEP);
+    key.z = std::llround(point.z / POINT_KEY_STEP);
+    return key;
+}
+
+size_t TubeRepository::PointKeyHash::operator()(const PointKey& key) const
+{
+    // Перемешивание как в пространственном хешировании (Teschner et al.)
+    const uint64_t h = static_cast<uint64_t>(key.x) * 73856093ULL
+                       ^ static_cast<uint64_t>(key.y) * 19349663ULL
+                       ^ static_cast<uint64_t>(key.z) * 83492791ULL;
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+int64_t TubeRepository::idAtIndex(const IdByIndex& ids, int index)
+{
+    if (index < 0 || static_cast<size_t>(index) >= ids.size()) {
+        return -1;
+    }
+    return ids[index];
+}
 
-    const float epsilon = 0.001f;
-    float roundedX = std::round(point.x / epsilon) * epsilon;
-    float roundedY = std::round(point.y / epsilon) * epsilon;
-    float roundedZ = std::round(point.z / epsilon) * epsilon;
+void TubeRepository::setIdAtIndex(IdByIndex& ids, int index, int64_t id)
+{
+    if (index < 0) {
+        return;
+    }
+    if (ids.size() <= static_cast<size_t>(index)) {
+        ids.resize(index + 1, -1);
+    }
+    ids[index] = id;
+}
 
-    return std::make_tuple(roundedX, roundedY, roundedZ);
+QVariant TubeRepository::idOrNull(int64_t id) const
+{
+    // -1 означает отсутствие ссылки. NULL привязывается с типом bigint:
+    // по нетипизированному QVariant() QPSQL не может вывести тип параметра
+    return id == -1 ? QVariant(QMetaType::fromType<qlonglong>())
+                    : QVariant(static_cast<qlonglong>(id));
+}
+
+bool TubeRepository::setFutureId(const QString& table, int64_t oldId, int64_t newId)
+{
+    QSqlQuery* query = db.getPreparedQuery(
+        "update_future_" + table,
+        QString("UPDATE %1 SET future_%1_id = :future_id WHERE id = :id").arg(table));
+    if (!query) {
+        setLastError("Failed to prepare future link update: " + db.getLastError());
+        return false;
+    }
+
+    query->bindValue(":future_id", static_cast<qlonglong>(newId));
+    query->bindValue(":id", static_cast<qlonglong>(oldId));
+
+    if (!db.executePrepared(*query)) {
+        setLastError(QString("Failed to set future_%1_id: %2").arg(table).arg(db.getLastError()));
+        return false;
+    }
+
+    return true;
 }
 
 bool TubeRepository::linkTubeVersions(int64_t oldTubeId, int64_t newTubeId)
 {
+    DatabaseManager::OperationScope operation(db, "link");
     qDebug() << "TubeRepository::linkTubeVersions - Linking tube versions";
     qDebug() << "  Old tube ID:" << oldTubeId;
     qDebug() << "  New tube ID:" << newTubeId;
@@ -978,71 +1882,282 @@ int64_t TubeRepository::getPastTubeId(int64_t tubeId)
         return -1;
     }
 
-    QString query = QString("SELECT past_tube_id FROM tube WHERE id = %1").arg(tubeId);
-    QSqlQuery result = db.executeQuery(query);
+    QSqlQuery* query = db.getPreparedQuery(
+        "select_past_tube_id",
+        "SELECT past_tube_id FROM tube WHERE id = :id");
+
+    if (query) {
+        query->bindValue(":id", static_cast<qlonglong>(tubeId));
+        if (db.executePrepared(*query) && query->next()) {
+            QVariant pastId = query->value(0);
+            if (pastId.isNull()) {
+                return -1;
+            }
+            return pastId.toLongLong();
+        }
+    }
+
+    setLastError("Failed to get past_tube_id");
+    return -1;
+}
+
+int64_t TubeRepository::getFutureTubeId(int64_t tubeId)
+{
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return -1;
+    }
+
+    QSqlQuery* query = db.getPreparedQuery(
+        "select_future_tube_id",
+        "SELECT future_tube_id FROM tube WHERE id = :id");
+
+    if (query) {
+        query->bindValue(":id", static_cast<qlonglong>(tubeId));
+        if (db.executePrepared(*query) && query->next()) {
+            QVariant futureId = query->value(0);
+            if (futureId.isNull()) {
+                return -1;
+            }
+            return futureId.toLongLong();
+        }
+    }
+
+    setLastError("Failed to get future_tube_id");
+    return -1;
+}
+
+bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube, LoadMode mode)
+{
+    DatabaseManager::OperationScope operation(db, "load");
+    qDebug() << "TubeRepository::loadTubeById - Loading tube with id:" << tubeId
+             << "mode:" << (mode == LoadMode::Batched ? "batched" : "per-row");
+
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    lastLoadedVerId = -1;
+    bool loaded = (mode == LoadMode::Batched)
+                      ? loadTubeByIdBatched(tubeId, tube)
+                      : loadTubeByIdPerRow(tubeId, tube);
+
+    lastLoadTimeMs = timer.elapsed();
+
+    qDebug() << "TubeRepository::loadTubeById - tube" << tubeId
+             << (loaded ? "loaded" : "failed") << "in" << lastLoadTimeMs << "ms";
+    return loaded;
+}
+
+qint64 TubeRepository::getLastLoadTimeMs() const
+{
+    return lastLoadTimeMs;
+}
+
+int TubeRepository::getLastLoadedVerId() const
+{
+    return lastLoadedVerId;
+}
+
+bool TubeRepository::loadTubeByIdBatched(int64_t tubeId, Tube& tube)
+{
+    // ---- 0) Трубка
+    int storageKind = STORAGE_SNAPSHOT;
+    if (!readTubeHeader(tubeId, lastLoadedVerId, storageKind)) {
+        return false;
+    }
+    qDebug() << "Loading tube with ver_id:" << lastLoadedVerId;
+
+    if (storageKind == STORAGE_DELTA) {
+        return loadDeltaChain(tubeId, tube);
+    }
+
+    return loadSnapshotBatched(tubeId, tube);
+}
+
+bool TubeRepository::loadSnapshotBatched(int64_t tubeId, Tube& tube)
+{
+    tube.clear();
+
+    // ---- 1) Сечения по порядку индекса (вместе с упакованным контуром, если он есть)
+    std::vector<int64_t> sectionIds;
+    std::vector<int> sectionIndices;
+    std::vector<Section> sections;
+    std::unordered_map<int64_t, size_t> sectionSlotById;  // section_id -> позиция в sectionIds
+    bool allContoursPacked = true;
+    {
+        QString sectionsQuery =
+            QString("SELECT id, \"index\", contour FROM section WHERE tube_id = %1 ORDER BY \"index\"").arg(tubeId);
+        QSqlQuery sectionsResult = db.executeQuery(sectionsQuery);
+
+        while (sectionsResult.next()) {
+            sectionSlotById[sectionsResult.value(0).toLongLong()] = sectionIds.size();
+            sectionIds.push_back(sectionsResult.value(0).toLongLong());
+            sectionIndices.push_back(sectionsResult.value(1).toInt());
+
+            Section section;
+            if (allContoursPacked && !sectionsResult.value(2).isNull() &&
+                unpackContour(sectionsResult.value(2).toByteArray(), section)) {
+                sections.push_back(section);
+            } else {
+                allContoursPacked = false;
+                sections.push_back(Section());
+            }
+        }
+    }
+
+    if (sectionIds.empty()) {
+        setLastError("No sections found for the tube");
+        return false;
+    }
+
+    // ---- 2) Все контурные точки трубки одним запросом (если контуры не упакованы)
+    if (!allContoursPacked) {
+        sections.assign(sectionIds.size(), Section());
+
+        QString pointsQuery =
+            QString("SELECT p.section_id, p.x, p.y, p.z "
+                    "FROM point p JOIN section s ON s.id = p.section_id "
+                    "WHERE s.tube_id = %1 AND p.index_in_section IS NOT NULL "
+                    "ORDER BY s.\"index\", p.index_in_section").arg(tubeId);
+        QSqlQuery pointsResult = db.executeQuery(pointsQuery);
+
+        while (pointsResult.next()) {
+            auto slot = sectionSlotById.find(pointsResult.value(0).toLongLong());
+            if (slot == sectionSlotById.end()) {
+                continue;
+            }
+
+            Point3D p;
+            p.x = pointsResult.value(1).toFloat();
+            p.y = pointsResult.value(2).toFloat();
+            p.z = pointsResult.value(3).toFloat();
+            sections[slot->second].addPoint(p);
+        }
+    }
+
+    for (size_t i = 0; i < sections.size(); ++i) {
+        if (tube.addSection(sections[i]) == -1) {
+            setLastError(QString("Failed to add section %1 to Tube").arg(sectionIndices[i]));
+            return false;
+        }
+    }
+
+    // ---- 3) Сегменты
+    std::vector<int> segmentIndices;
+    std::unordered_map<int64_t, size_t> segmentSlotById;  // segment_id -> позиция в segmentIndices
+    {
+        QString segQ =
+            QString("SELECT id, \"index\" FROM segment WHERE tube_id = %1 ORDER BY \"index\"").arg(tubeId);
+        QSqlQuery segRes = db.executeQuery(segQ);
+
+        while (segRes.next()) {
+            segmentSlotById[segRes.value(0).toLongLong()] = segmentIndices.size();
+            segmentIndices.push_back(segRes.value(1).toInt());
+        }
+    }
+
+    // ---- 4) Все рёбра вместе с точками и индексами их сечений
+    std::vector<std::vector<Edge>> segmentEdges(segmentIndices.size());
+    std::vector<std::set<int>> segmentSectionIndices(segmentIndices.size());
+    {
+        QString edgeQ =
+            QString("SELECT e.segment_id, e.\"index\", "
+                    "       sp.x, sp.y, sp.z, sp.index_in_section, ss.\"index\", "
+                    "       ep.x, ep.y, ep.z, ep.index_in_section, es.\"index\" "
+                    "FROM edge e "
+                    "JOIN segment g ON g.id = e.segment_id "
+                    "JOIN point sp ON sp.id = e.start_point_id "
+                    "JOIN section ss ON ss.id = sp.section_id "
+                    "JOIN point ep ON ep.id = e.end_point_id "
+                    "JOIN section es ON es.id = ep.section_id "
+                    "WHERE g.tube_id = %1 "
+                    "ORDER BY g.\"index\", e.\"index\"").arg(tubeId);
+        QSqlQuery edgeRes = db.executeQuery(edgeQ);
+
+        while (edgeRes.next()) {
+            auto slot = segmentSlotById.find(edgeRes.value(0).toLongLong());
+            if (slot == segmentSlotById.end()) {
+                continue;
+            }
 
-    if (result.next()) {
-        QVariant pastId = result.value(0);
-        if (pastId.isNull()) {
-            return -1;
+            bool spFromSection = !edgeRes.value(5).isNull();
+            bool epFromSection = !edgeRes.value(10).isNull();
+            int  spSecIndex    = edgeRes.value(6).toInt();
+            int  epSecIndex    = edgeRes.value(11).toInt();
+
+            Edge e;
+            e.setIndex(edgeRes.value(1).toInt());
+            e.setStartPoint(Point3D(edgeRes.value(2).toFloat(),
+                                    edgeRes.value(3).toFloat(),
+                                    edgeRes.value(4).toFloat()));
+            e.setEndPoint(Point3D(edgeRes.value(7).toFloat(),
+                                  edgeRes.value(8).toFloat(),
+                                  edgeRes.value(9).toFloat()));
+            e.setSectionIndices(spSecIndex, epSecIndex);
+            e.setPointIndices(spFromSection ? edgeRes.value(5).toInt() : -1,
+                              epFromSection ? edgeRes.value(10).toInt() : -1);
+
+            segmentEdges[slot->second].push_back(e);
+            segmentSectionIndices[slot->second].insert(spSecIndex);
+            segmentSectionIndices[slot->second].insert(epSecIndex);
         }
-        return pastId.toLongLong();
     }
 
-    setLastError("Failed to get past_tube_id");
-    return -1;
-}
+    for (size_t i = 0; i < segmentIndices.size(); ++i) {
+        int segIndex = segmentIndices[i];
 
-int64_t TubeRepository::getFutureTubeId(int64_t tubeId)
-{
-    if (!db.isConnected()) {
-        setLastError("Database is not connected");
-        return -1;
-    }
+        if (segmentSectionIndices[i].size() != 2) {
+            setLastError(QString("Segment %1 has %2 distinct sections (expected 2)")
+                             .arg(segIndex).arg(segmentSectionIndices[i].size()));
+            return false;
+        }
 
-    QString query = QString("SELECT future_tube_id FROM tube WHERE id = %1").arg(tubeId);
-    QSqlQuery result = db.executeQuery(query);
+        auto it = segmentSectionIndices[i].begin();
+        int startSectionIndex = *it; ++it;
+        int endSectionIndex   = *it;
 
-    if (result.next()) {
-        QVariant futureId = result.value(0);
-        if (futureId.isNull()) {
-            return -1;
+        Segment seg(segIndex, startSectionIndex, endSectionIndex);
+        seg.connectingEdges = std::move(segmentEdges[i]);
+        seg.reindexEdges();
+
+        if (tube.addSegment(seg) == -1) {
+            setLastError(QString("Failed to add segment %1 to Tube").arg(segIndex));
+            return false;
         }
-        return futureId.toLongLong();
     }
 
-    setLastError("Failed to get future_tube_id");
-    return -1;
+    qDebug() << "Tube loaded successfully with"
+             << tube.getSectionCount() << "sections and"
+             << tube.getSegmentCount() << "segments";
+    return true;
 }
 
-bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
+bool TubeRepository::loadTubeByIdPerRow(int64_t tubeId, Tube& tube)
 {
-    qDebug() << "TubeRepository::loadTubeById - Loading tube with id:" << tubeId;
+    tube.clear();
 
-    if (!db.isConnected()) {
-        setLastError("Database is not connected");
+    // ---- Проверим, что трубка существует
+    int storageKind = STORAGE_SNAPSHOT;
+    if (!readTubeHeader(tubeId, lastLoadedVerId, storageKind)) {
         return false;
     }
+    qDebug() << "Loading tube with ver_id:" << lastLoadedVerId;
 
-    tube.clear();
-
-    // ---- Проверим, что трубка существует
-    {
-        QString tubeQuery = QString("SELECT ver_id FROM tube WHERE id = %1").arg(tubeId);
-        QSqlQuery tubeResult = db.executeQuery(tubeQuery);
-        if (!tubeResult.next()) {
-            setLastError(QString("Tube with id %1 not found").arg(tubeId));
-            return false;
-        }
-        int verId = tubeResult.value(0).toInt();
-        qDebug() << "Loading tube with ver_id:" << verId;
+    // Дельта-версии собираются из снимка, построчного варианта для них нет
+    if (storageKind == STORAGE_DELTA) {
+        return loadDeltaChain(tubeId, tube);
     }
 
     // ---- 1) Секциям: читаем сами секции и их контурные точки (index_in_section NOT NULL)
     {
         QString sectionsQuery =
-            QString("SELECT id, index, x_cen, y_cen, z_cen "
-                    "FROM section WHERE tube_id = %1 ORDER BY index").arg(tubeId);
+            QString("SELECT id, \"index\", x_cen, y_cen, z_cen "
+                    "FROM section WHERE tube_id = %1 ORDER BY \"index\"").arg(tubeId);
         QSqlQuery sectionsResult = db.executeQuery(sectionsQuery);
 
         while (sectionsResult.next()) {
@@ -1087,8 +2202,8 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
     // ---- 2) Сегменты и рёбра: читаем как сохранены, НИЧЕГО не перестраиваем
     {
         QString segQ =
-            QString("SELECT id, index FROM segment "
-                    "WHERE tube_id = %1 ORDER BY index").arg(tubeId);
+            QString("SELECT id, \"index\" FROM segment "
+                    "WHERE tube_id = %1 ORDER BY \"index\"").arg(tubeId);
         QSqlQuery segRes = db.executeQuery(segQ);
 
         while (segRes.next()) {
@@ -1101,7 +2216,7 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
             // набор секций по стартовым точкам
             {
                 QString q =
-                    QString("SELECT DISTINCT s.index "
+                    QString("SELECT DISTINCT s.\"index\" "
                             "FROM edge e "
                             "JOIN point p ON p.id = e.start_point_id "
                             "JOIN section s ON s.id = p.section_id "
@@ -1112,7 +2227,7 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
             // набор секций по конечным точкам
             {
                 QString q =
-                    QString("SELECT DISTINCT s.index "
+                    QString("SELECT DISTINCT s.\"index\" "
                             "FROM edge e "
                             "JOIN point p ON p.id = e.end_point_id "
                             "JOIN section s ON s.id = p.section_id "
@@ -1135,8 +2250,8 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
 
             // Читаем рёбра по порядку индекса
             QString edgeQ =
-                QString("SELECT id, index, start_point_id, end_point_id "
-                        "FROM edge WHERE segment_id = %1 ORDER BY index").arg(segmentId);
+                QString("SELECT id, \"index\", start_point_id, end_point_id "
+                        "FROM edge WHERE segment_id = %1 ORDER BY \"index\"").arg(segmentId);
             QSqlQuery edgeRes = db.executeQuery(edgeQ);
 
             while (edgeRes.next()) {
@@ -1147,7 +2262,7 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
 
                 // Стартовая точка ребра
                 QString spQ =
-                    QString("SELECT p.x, p.y, p.z, p.index_in_section, s.index "
+                    QString("SELECT p.x, p.y, p.z, p.index_in_section, s.\"index\" "
                             "FROM point p JOIN section s ON s.id = p.section_id "
                             "WHERE p.id = %1").arg(spId);
                 QSqlQuery sp = db.executeQuery(spQ);
@@ -1164,7 +2279,7 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
 
                 // Конечная точка ребра
                 QString epQ =
-                    QString("SELECT p.x, p.y, p.z, p.index_in_section, s.index "
+                    QString("SELECT p.x, p.y, p.z, p.index_in_section, s.\"index\" "
                             "FROM point p JOIN section s ON s.id = p.section_id "
                             "WHERE p.id = %1").arg(epId);
                 QSqlQuery ep = db.executeQuery(epQ);
@@ -1209,6 +2324,8 @@ bool TubeRepository::loadTubeById(int64_t tubeId, Tube& tube)
 
 bool TubeRepository::deleteFutureVersions(int64_t fromTubeId)
 {
+    DatabaseManager::OperationScope operation(db, "delete");
+    SectionGridReset gridReset;
     qDebug() << "TubeRepository::deleteFutureVersions - Deleting versions after tube_id:" << fromTubeId;
 
     if (!db.isConnected()) {
@@ -1221,14 +2338,23 @@ bool TubeRepository::deleteFutureVersions(int64_t fromTubeId)
         return false;
     }
 
+    // Вся цепочка future_tube_id одним запросом
+    QString chainQuery = QString(
+                             "WITH RECURSIVE chain AS ( "
+                             "  SELECT future_tube_id AS id FROM tube "
+                             "  WHERE id = %1 AND future_tube_id IS NOT NULL "
+                             "  UNION "
+                             "  SELECT t.future_tube_id FROM tube t JOIN chain c ON t.id = c.id "
+                             "  WHERE t.future_tube_id IS NOT NULL "
+                             ") "
+                             "SELECT id FROM chain"
+                             ).arg(fromTubeId);
 
-    std::vector<int64_t> tubeIdsToDelete;
-    int64_t currentId = getFutureTubeId(fromTubeId);
+    QSqlQuery chainResult = db.executeQuery(chainQuery);
 
-    while (currentId != -1) {
-        tubeIdsToDelete.push_back(currentId);
-        int64_t nextId = getFutureTubeId(currentId);
-        currentId = nextId;
+    std::vector<int64_t> tubeIdsToDelete;
+    while (chainResult.next()) {
+        tubeIdsToDelete.push_back(chainResult.value(0).toLongLong());
     }
 
     if (tubeIdsToDelete.empty()) {
@@ -1239,50 +2365,444 @@ bool TubeRepository::deleteFutureVersions(int64_t fromTubeId)
 
     qDebug() << "Found" << tubeIdsToDelete.size() << "versions to delete";
 
+    // По одному DELETE на таблицу для всей цепочки
+    const StorageBackend& backend = db.getBackend();
+    const QString byTube = backend.idListPredicate("tube_id", tubeIdsToDelete);
+    QStringList deleteQueries = {
+        QString("DELETE FROM edge WHERE segment_id IN "
+                "(SELECT id FROM segment WHERE %1)").arg(byTube),
+        QString("DELETE FROM segment WHERE %1").arg(byTube),
+        QString("DELETE FROM point WHERE section_id IN "
+                "(SELECT id FROM section WHERE %1)").arg(byTube),
+        QString("DELETE FROM section WHERE %1").arg(byTube),
+        QString("DELETE FROM point_delta WHERE %1").arg(byTube),
+        QString("DELETE FROM tube WHERE %1").arg(backend.idListPredicate("id", tubeIdsToDelete)),
+        QString("UPDATE tube SET future_tube_id = NULL WHERE id = %1").arg(fromTubeId)
+    };
+
+    for (const QString& query : deleteQueries) {
+        if (!db.execute(query)) {
+            db.rollbackTransaction();
+            setLastError("Failed to delete future versions: " + db.getLastError());
+            return false;
+        }
+    }
+
+    if (!db.commitTransaction()) {
+        db.rollbackTransaction();
+        setLastError("Failed to commit transaction: " + db.getLastError());
+        return false;
+    }
 
-    for (auto it = tubeIdsToDelete.rbegin(); it != tubeIdsToDelete.rend(); ++it) {
-        int64_t tubeId = *it;
-        qDebug() << "Deleting tube_id:" << tubeId;
+    qDebug() << "Successfully deleted" << tubeIdsToDelete.size() << "future versions";
+    return true;
+}
 
+std::vector<TubeRepository::VersionInfo> TubeRepository::getVersionHistory(int64_t tubeId)
+{
+    DatabaseManager::OperationScope operation(db, "history");
+    std::vector<VersionInfo> history;
 
-        QString deleteEdges = QString("DELETE FROM edge WHERE segment_id IN "
-                                      "(SELECT id FROM segment WHERE tube_id = %1)").arg(tubeId);
-        db.executeQuery(deleteEdges);
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return history;
+    }
 
+    // Назад по past_tube_id и вперёд по future_tube_id; pos - смещение от tubeId.
+    // Схема не запрещает циклические связи, а pos у повторов разный (UNION их не отсечёт),
+    // поэтому глубина ограничена числом трубок: длиннее цепочка без цикла быть не может.
+    // Трубка, встреченная в цикле повторно, попадает в историю один раз
+    QString query = QString(
+                        "WITH RECURSIVE limits AS ( "
+                        "  SELECT count(*) AS depth FROM tube "
+                        "), back AS ( "
+                        "  SELECT id, past_tube_id, 0 AS pos FROM tube WHERE id = %1 "
+                        "  UNION ALL "
+                        "  SELECT t.id, t.past_tube_id, b.pos - 1 FROM tube t JOIN back b ON t.id = b.past_tube_id "
+                        "  WHERE -b.pos < (SELECT depth FROM limits) "
+                        "), fwd AS ( "
+                        "  SELECT id, future_tube_id, 0 AS pos FROM tube WHERE id = %1 "
+                        "  UNION ALL "
+                        "  SELECT t.id, t.future_tube_id, f.pos + 1 FROM tube t JOIN fwd f ON t.id = f.future_tube_id "
+                        "  WHERE f.pos < (SELECT depth FROM limits) "
+                        "), chain AS ( "
+                        "  SELECT id, max(pos) AS pos FROM back GROUP BY id "
+                        "  UNION ALL "
+                        "  SELECT id, min(pos) FROM fwd WHERE id NOT IN (SELECT id FROM back) GROUP BY id "
+                        ") "
+                        "SELECT t.id, t.ver_id, t.storage_kind FROM chain c JOIN tube t ON t.id = c.id "
+                        "ORDER BY c.pos"
+                        ).arg(tubeId);
 
-        QString deleteSegments = QString("DELETE FROM segment WHERE tube_id = %1").arg(tubeId);
-        db.executeQuery(deleteSegments);
+    QSqlQuery result = db.executeQuery(query);
+    while (result.next()) {
+        VersionInfo info;
+        info.tubeId = result.value(0).toLongLong();
+        info.verId = result.value(1).toInt();
+        info.isDelta = result.value(2).toInt() == STORAGE_DELTA;
+        history.push_back(info);
+    }
 
+    if (history.empty()) {
+        setLastError(QString("Tube with id %1 not found").arg(tubeId));
+    }
 
-        QString deletePoints = QString("DELETE FROM point WHERE section_id IN "
-                                       "(SELECT id FROM section WHERE tube_id = %1)").arg(tubeId);
-        db.executeQuery(deletePoints);
+    return history;
+}
 
+bool TubeRepository::diffVersions(int64_t oldTubeId, int64_t newTubeId, VersionDiff& diff)
+{
+    DatabaseManager::OperationScope operation(db, "diff");
+    diff = VersionDiff();
 
-        QString deleteSections = QString("DELETE FROM section WHERE tube_id = %1").arg(tubeId);
-        db.executeQuery(deleteSections);
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return false;
+    }
 
+    // Фактические координаты контурных точек обеих версий: точки ближайшего снимка,
+    // поверх них самые свежие значения из point_delta по цепочке base_tube_id.
+    // Точки сопоставляются по (индекс сечения, индекс в сечении) - так же, как их связывают
+    // past_point_id/future_point_id; центры сечений - средние их точек (как Section::getCenter)
+    QString query = QString(
+                        "WITH RECURSIVE chain AS ( "
+                        "  SELECT id AS version_id, id, base_tube_id, storage_kind, 0 AS depth "
+                        "  FROM tube WHERE id IN (%1, %2) "
+                        "  UNION ALL "
+                        "  SELECT c.version_id, t.id, t.base_tube_id, t.storage_kind, c.depth + 1 "
+                        "  FROM tube t JOIN chain c ON t.id = c.base_tube_id "
+                        "  WHERE c.storage_kind = %3 "
+                        "), base_points AS ( "
+                        "  SELECT c.version_id, s.\"index\" AS section_index, p.index_in_section, p.x, p.y, p.z "
+                        "  FROM chain c "
+                        "  JOIN section s ON s.tube_id = c.id "
+                        "  JOIN point p ON p.section_id = s.id "
+                        "  WHERE c.storage_kind = %4 AND p.index_in_section IS NOT NULL "
+                        "), delta_points AS ( "
+                        "  SELECT version_id, section_index, index_in_section, x, y, z FROM ( "
+                        "    SELECT c.version_id, d.section_index, d.index_in_section, d.x, d.y, d.z, "
+                        "           row_number() OVER (PARTITION BY c.version_id, d.section_index, d.index_in_section "
+                        "                              ORDER BY c.depth) AS rn "
+                        "    FROM chain c JOIN point_delta d ON d.tube_id = c.id "
+                        "    WHERE c.storage_kind = %3 "
+                        "  ) AS ranked WHERE rn = 1 "
+                        "), points AS ( "
+                        "  SELECT b.version_id, b.section_index, b.index_in_section, "
+                        "         COALESCE(d.x, b.x) AS x, COALESCE(d.y, b.y) AS y, COALESCE(d.z, b.z) AS z "
+                        "  FROM base_points b "
+                        "  LEFT JOIN delta_points d ON d.version_id = b.version_id "
+                        "   AND d.section_index = b.section_index AND d.index_in_section = b.index_in_section "
+                        "), centers AS ( "
+                        "  SELECT version_id, section_index, AVG(x) AS x, AVG(y) AS y, AVG(z) AS z "
+                        "  FROM points GROUP BY version_id, section_index "
+                        ") "
+                        "SELECT 0 AS kind, o.section_index, o.index_in_section, "
+                        "       n.x - o.x, n.y - o.y, n.z - o.z "
+                        "FROM points o JOIN points n "
+                        "  ON n.section_index = o.section_index AND n.index_in_section = o.index_in_section "
+                        "WHERE o.version_id = %1 AND n.version_id = %2 "
+                        "UNION ALL "
+                        "SELECT 1 AS kind, o.section_index, 0, n.x - o.x, n.y - o.y, n.z - o.z "
+                        "FROM centers o JOIN centers n ON n.section_index = o.section_index "
+                        "WHERE o.version_id = %1 AND n.version_id = %2 "
+                        "ORDER BY 1, 2, 3"
+                        ).arg(oldTubeId).arg(newTubeId).arg(STORAGE_DELTA).arg(STORAGE_SNAPSHOT);
 
-        QString deleteTube = QString("DELETE FROM tube WHERE id = %1").arg(tubeId);
-        db.executeQuery(deleteTube);
+    QSqlQuery result = db.executeQuery(query);
+    if (!result.isActive()) {
+        setLastError("Failed to compute version diff: " + db.getLastError());
+        return false;
     }
 
+    double displacementSum = 0.0;
+    while (result.next()) {
+        const int sectionIndex = result.value(1).toInt();
+        const float dx = result.value(3).toFloat();
+        const float dy = result.value(4).toFloat();
+        const float dz = result.value(5).toFloat();
+
+        if (result.value(0).toInt() == 1) {
+            diff.sectionIndices.push_back(sectionIndex);
+            diff.centerShifts.insert(diff.centerShifts.end(), {dx, dy, dz});
+            continue;
+        }
 
-    QString updateQuery = QString("UPDATE tube SET future_tube_id = NULL WHERE id = %1").arg(fromTubeId);
-    db.executeQuery(updateQuery);
+        const int indexInSection = result.value(2).toInt();
+        diff.pointSectionIndices.push_back(sectionIndex);
+        diff.pointIndices.push_back(indexInSection);
+        diff.pointDisplacements.insert(diff.pointDisplacements.end(), {dx, dy, dz});
 
-    if (!db.commitTransaction()) {
-        db.rollbackTransaction();
-        setLastError("Failed to commit transaction: " + db.getLastError());
+        const float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+        displacementSum += length;
+        if (length > deltaEpsilon) {
+            diff.movedPointCount++;
+        }
+        if (length > diff.maxDisplacement) {
+            diff.maxDisplacement = length;
+            diff.maxDisplacementSection = sectionIndex;
+            diff.maxDisplacementPoint = indexInSection;
+        }
+    }
+
+    if (diff.pointIndices.empty()) {
+        setLastError(QString("Versions %1 and %2 have no matching points").arg(oldTubeId).arg(newTubeId));
         return false;
     }
 
-    qDebug() << "Successfully deleted" << tubeIdsToDelete.size() << "future versions";
+    diff.meanDisplacement = static_cast<float>(displacementSum / diff.pointIndices.size());
+
+    qDebug() << "Version diff" << oldTubeId << "->" << newTubeId << ":"
+             << diff.pointIndices.size() << "points," << diff.movedPointCount << "moved,"
+             << "max" << diff.maxDisplacement << "mean" << diff.meanDisplacement;
     return true;
 }
 
+void TubeRepository::setSpatialSearchMargin(float margin)
+{
+    spatialSearchMargin = std::max(0.0f, margin);
+}
+
+void TubeRepository::invalidateSpatialCache()
+{
+    SectionGridReset reset;
+}
+
+std::shared_ptr<const SectionCenterGrid> TubeRepository::getSectionGrid()
+{
+    SharedSectionGrid& shared = sharedSectionGrid();
+    const QString key = sectionGridKey(db);
+    quint64 generation;
+    {
+        QMutexLocker locker(&shared.mutex);
+        if (shared.grid && shared.databaseKey == key) {
+            return shared.grid;
+        }
+        generation = shared.generation;
+    }
+
+    // Дельта-версии пишутся только в СУБД с массивами, у которых есть и индекс:
+    // здесь все центры лежат в section
+    QSqlQuery result = db.executeQuery("SELECT id, tube_id, \"index\", x_cen, y_cen, z_cen FROM section");
+    if (!result.isActive()) {
+        setLastError("Failed to read section centers: " + db.getLastError());
+        return nullptr;
+    }
+
+    std::vector<SectionCenterGrid::Entry> centers;
+    while (result.next()) {
+        SectionCenterGrid::Entry entry;
+        entry.sectionId = result.value(0).toLongLong();
+        entry.tubeId = result.value(1).toLongLong();
+        entry.sectionIndex = result.value(2).toInt();
+        entry.center = Point3D(result.value(3).toFloat(),
+                               result.value(4).toFloat(),
+                               result.value(5).toFloat());
+        centers.push_back(entry);
+    }
+
+    auto grid = std::make_shared<SectionCenterGrid>();
+    grid->build(std::move(centers));
+    qDebug() << "Section center grid built:" << grid->getEntryCount() << "centers";
+
+    QMutexLocker locker(&shared.mutex);
+    if (shared.generation == generation) {
+        shared.grid = grid;
+        shared.databaseKey = key;
+    }
+    return grid;
+}
+
+std::vector<TubeRepository::SectionLocation> TubeRepository::findSectionsInBox(
+    const Point3D& minCorner, const Point3D& maxCorner)
+{
+    DatabaseManager::OperationScope operation(db, "spatial");
+    std::vector<SectionLocation> sections;
+
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return sections;
+    }
+
+    if (!db.getBackend().supportsSpatialIndex()) {
+        std::shared_ptr<const SectionCenterGrid> sectionGrid = getSectionGrid();
+        if (!sectionGrid) {
+            return sections;
+        }
+        for (size_t position : sectionGrid->queryBox(minCorner, maxCorner)) {
+            const SectionCenterGrid::Entry& entry = sectionGrid->getEntry(position);
+            sections.push_back({entry.sectionId, entry.tubeId, entry.sectionIndex, entry.center});
+        }
+        std::sort(sections.begin(), sections.end(),
+                  [](const SectionLocation& a, const SectionLocation& b) {
+                      return a.tubeId != b.tubeId ? a.tubeId < b.tubeId
+                                                  : a.sectionIndex < b.sectionIndex;
+                  });
+        return sections;
+    }
+
+    // Выражение box(point, point) должно совпадать с выражением индексов idx_section_center
+    // и idx_delta_section_center; центры дельта-версий - из delta_section_center
+    QString query = QString(
+                        "SELECT id, tube_id, \"index\", x_cen, y_cen, z_cen FROM section "
+                        "WHERE box(point(x_cen, y_cen), point(x_cen, y_cen)) && box(point(%1, %2), point(%3, %4)) "
+                        "  AND z_cen BETWEEN %5 AND %6 "
+                        "UNION ALL "
+                        "SELECT section_id, tube_id, \"index\", x_cen, y_cen, z_cen FROM delta_section_center "
+                        "WHERE box(point(x_cen, y_cen), point(x_cen, y_cen)) && box(point(%1, %2), point(%3, %4)) "
+                        "  AND z_cen BETWEEN %5 AND %6 "
+                        "ORDER BY tube_id, \"index\""
+                        ).arg(minCorner.x, 0, 'g', 9).arg(minCorner.y, 0, 'g', 9)
+                        .arg(maxCorner.x, 0, 'g', 9).arg(maxCorner.y, 0, 'g', 9)
+                        .arg(minCorner.z, 0, 'g', 9).arg(maxCorner.z, 0, 'g', 9);
+
+    QSqlQuery result = db.executeQuery(query);
+    if (!result.isActive()) {
+        setLastError("Failed to query sections in box: " + db.getLastError());
+        return sections;
+    }
+
+    while (result.next()) {
+        SectionLocation location;
+        location.sectionId = result.value(0).toLongLong();
+        location.tubeId = result.value(1).toLongLong();
+        location.sectionIndex = result.value(2).toInt();
+        location.center = Point3D(result.value(3).toFloat(),
+                                  result.value(4).toFloat(),
+                                  result.value(5).toFloat());
+        sections.push_back(location);
+    }
+
+    qDebug() << "Sections in box:" << sections.size();
+    return sections;
+}
+
+std::vector<TubeRepository::TubeProximity> TubeRepository::findTubesNearPoint(const Point3D& point,
+                                                                              float radius)
+{
+    DatabaseManager::OperationScope operation(db, "spatial");
+    std::vector<TubeProximity> tubes;
+
+    if (!db.isConnected()) {
+        setLastError("Database is not connected");
+        return tubes;
+    }
+
+    if (radius < 0.0f) {
+        setLastError("Search radius must not be negative");
+        return tubes;
+    }
+
+    // Куб поиска кандидатов: осевая линия ближе radius проходит через звено,
+    // хотя бы один конец которого не дальше radius + margin по каждой оси
+    const float reach = radius + spatialSearchMargin;
+    const Point3D minCorner(point.x - reach, point.y - reach, point.z - reach);
+    const Point3D maxCorner(point.x + reach, point.y + reach, point.z + reach);
+
+    // Осевые линии кандидатов: tube_id -> центры по возрастанию индекса
+    std::vector<std::pair<int64_t, std::vector<Point3D>>> centerlines;
+
+    if (!db.getBackend().supportsSpatialIndex()) {
+        std::shared_ptr<const SectionCenterGrid> sectionGrid = getSectionGrid();
+        if (!sectionGrid) {
+            return tubes;
+        }
+        std::vector<int64_t> candidateIds;
+        for (size_t position : sectionGrid->queryBox(minCorner, maxCorner)) {
+            candidateIds.push_back(sectionGrid->getEntry(position).tubeId);
+        }
+        std::sort(candidateIds.begin(), candidateIds.end());
+        candidateIds.erase(std::unique(candidateIds.begin(), candidateIds.end()), candidateIds.end());
+
+        for (int64_t tubeId : candidateIds) {
+            std::vector<Point3D> centers;
+            for (size_t position : sectionGrid->getCenterline(tubeId)) {
+                centers.push_back(sectionGrid->getEntry(position).center);
+            }
+            centerlines.emplace_back(tubeId, std::move(centers));
+        }
+    } else {
+        // Кандидаты по индексам, их осевые линии - в том же запросе;
+        // центры снимков - в section, дельта-версий - в delta_section_center
+        QString query = QString(
+                            "WITH centers AS ( "
+                            "  SELECT tube_id, \"index\", x_cen, y_cen, z_cen FROM section "
+                            "  UNION ALL "
+                            "  SELECT tube_id, \"index\", x_cen, y_cen, z_cen FROM delta_section_center "
+                            ") "
+                            "SELECT c.tube_id, c.x_cen, c.y_cen, c.z_cen FROM centers c "
+                            "WHERE c.tube_id IN ( "
+                            "  SELECT tube_id FROM section "
+                            "  WHERE box(point(x_cen, y_cen), point(x_cen, y_cen)) && box(point(%1, %2), point(%3, %4)) "
+                            "    AND z_cen BETWEEN %5 AND %6 "
+                            "  UNION "
+                            "  SELECT tube_id FROM delta_section_center "
+                            "  WHERE box(point(x_cen, y_cen), point(x_cen, y_cen)) && box(point(%1, %2), point(%3, %4)) "
+                            "    AND z_cen BETWEEN %5 AND %6 "
+                            ") "
+                            "ORDER BY c.tube_id, c.\"index\""
+                            ).arg(minCorner.x, 0, 'g', 9).arg(minCorner.y, 0, 'g', 9)
+                            .arg(maxCorner.x, 0, 'g', 9).arg(maxCorner.y, 0, 'g', 9)
+                            .arg(minCorner.z, 0, 'g', 9).arg(maxCorner.z, 0, 'g', 9);
+
+        QSqlQuery result = db.executeQuery(query);
+        if (!result.isActive()) {
+            setLastError("Failed to query tubes near point: " + db.getLastError());
+            return tubes;
+        }
+
+        while (result.next()) {
+            const int64_t tubeId = result.value(0).toLongLong();
+            if (centerlines.empty() || centerlines.back().first != tubeId) {
+                centerlines.emplace_back(tubeId, std::vector<Point3D>());
+            }
+            centerlines.back().second.push_back(Point3D(result.value(1).toFloat(),
+                                                        result.value(2).toFloat(),
+                                                        result.value(3).toFloat()));
+        }
+    }
+
+    for (const auto& centerline : centerlines) {
+        const float distance = distanceToPolyline(point, centerline.second);
+        if (distance <= radius) {
+            tubes.push_back({centerline.first, distance});
+        }
+    }
+
+    std::sort(tubes.begin(), tubes.end(), [](const TubeProximity& a, const TubeProximity& b) {
+        return a.distance < b.distance;
+    });
+
+    qDebug() << "Tubes near point:" << tubes.size() << "of" << centerlines.size() << "candidates";
+    return tubes;
+}
+
+float TubeRepository::distanceToPolyline(const Point3D& point, const std::vector<Point3D>& polyline)
+{
+    if (polyline.empty()) {
+        return std::numeric_limits<float>::max();
+    }
+
+    float best = Point3D::distanceSquared(point, polyline.front());
+    for (size_t i = 1; i < polyline.size(); ++i) {
+        const Point3D& start = polyline[i - 1];
+        const Point3D direction = polyline[i] - start;
+        const float lengthSquared = direction.lengthSquared();
+
+        // Проекция на звено, ограниченная его концами
+        float t = 0.0f;
+        if (lengthSquared > 0.0f) {
+            t = Point3D::dotProduct(point - start, direction) / lengthSquared;
+            t = std::max(0.0f, std::min(1.0f, t));
+        }
+        best = std::min(best, Point3D::distanceSquared(point, start + direction * t));
+    }
+
+    return std::sqrt(best);
+}
+
 bool TubeRepository::linkVersionEntities(int64_t oldTubeId, int64_t newTubeId)
 {
+    DatabaseManager::OperationScope operation(db, "link");
     qDebug() << "TubeRepository::linkVersionEntities - Linking entities between versions";
     qDebug() << "  Old tube ID:" << oldTubeId;
     qDebug() << "  New tube ID:" << newTubeId;
@@ -1292,6 +2812,28 @@ bool TubeRepository::linkVersionEntities(int64_t oldTubeId, int64_t newTubeId)
         return false;
     }
 
+    // У дельта-версий нет собственных строк сечений/точек/рёбер: новая дельта
+    // пользуется строками своего базового снимка, связывать нечего
+    int64_t newSnapshotId = getSnapshotTubeId(newTubeId);
+    if (newSnapshotId == -1) {
+        return false;
+    }
+    if (newSnapshotId != newTubeId) {
+        qDebug() << "New version is a delta of snapshot" << newSnapshotId << ", entity linking skipped";
+        return true;
+    }
+
+    // Ключевой снимок после дельты связываем со строками снимка, на котором она основана,
+    // иначе цепочки past/future сущностей рвались бы на каждом ключевом кадре
+    int64_t oldSnapshotId = getSnapshotTubeId(oldTubeId);
+    if (oldSnapshotId == -1) {
+        return false;
+    }
+    if (oldSnapshotId != oldTubeId) {
+        qDebug() << "Old version is a delta, linking to entities of snapshot" << oldSnapshotId;
+        oldTubeId = oldSnapshotId;
+    }
+
     if (!db.beginTransaction()) {
         setLastError("Failed to begin transaction: " + db.getLastError());
         return false;
@@ -1339,71 +2881,45 @@ bool TubeRepository::linkSections(int64_t oldTubeId, int64_t newTubeId)
 {
     qDebug() << "Linking sections between tubes" << oldTubeId << "and" << newTubeId;
 
-    // Получаем все сечения старой версии
-    QString oldQuery = QString(
-                           "SELECT id, index FROM section WHERE tube_id = %1 ORDER BY index"
-                           ).arg(oldTubeId);
-
-    QSqlQuery oldResult = db.executeQuery(oldQuery);
-
-    std::map<int, int64_t> oldSectionsByIndex;
-    while (oldResult.next()) {
-        int64_t sectionId = oldResult.value(0).toLongLong();
-        int index = oldResult.value(1).toInt();
-        oldSectionsByIndex[index] = sectionId;
+    // Пары (старое сечение, новое сечение) по индексу
+    QString pairs = QString(
+                        "SELECT os.id AS old_id, ns.id AS new_id "
+                        "FROM section os "
+                        "JOIN section ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                        "WHERE os.tube_id = %1"
+                        ).arg(oldTubeId).arg(newTubeId);
+
+    // Проверяем, что количество сечений совпадает и все индексы сопоставлены
+    QString countQuery = QString(
+                             "SELECT (SELECT count(*) FROM section WHERE tube_id = %1), "
+                             "       (SELECT count(*) FROM section WHERE tube_id = %2), "
+                             "       (SELECT count(*) FROM (%3) m)"
+                             ).arg(oldTubeId).arg(newTubeId).arg(pairs);
+
+    QSqlQuery countResult = db.executeQuery(countQuery);
+    if (!countResult.next()) {
+        setLastError("Failed to count sections: " + db.getLastError());
+        return false;
     }
 
-    // Получаем все сечения новой версии
-    QString newQuery = QString(
-                           "SELECT id, index FROM section WHERE tube_id = %1 ORDER BY index"
-                           ).arg(newTubeId);
+    int64_t oldCount = countResult.value(0).toLongLong();
+    int64_t newCount = countResult.value(1).toLongLong();
+    int64_t matchedCount = countResult.value(2).toLongLong();
 
-    QSqlQuery newResult = db.executeQuery(newQuery);
-
-    std::map<int, int64_t> newSectionsByIndex;
-    while (newResult.next()) {
-        int64_t sectionId = newResult.value(0).toLongLong();
-        int index = newResult.value(1).toInt();
-        newSectionsByIndex[index] = sectionId;
+    if (oldCount != newCount) {
+        setLastError(QString("Section count mismatch: old=%1, new=%2").arg(oldCount).arg(newCount));
+        return false;
     }
 
-    // Проверяем, что количество сечений совпадает
-    if (oldSectionsByIndex.size() != newSectionsByIndex.size()) {
-        setLastError(QString("Section count mismatch: old=%1, new=%2")
-                         .arg(oldSectionsByIndex.size()).arg(newSectionsByIndex.size()));
+    if (matchedCount != oldCount) {
+        setLastError(QString("Only %1 of %2 sections have a matching index in the new version")
+                         .arg(matchedCount).arg(oldCount));
         return false;
     }
 
-    // Связываем сечения по индексу
-    int linkedCount = 0;
-    for (const auto& pair : oldSectionsByIndex) {
-        int index = pair.first;
-        int64_t oldSectionId = pair.second;
-
-        if (newSectionsByIndex.find(index) == newSectionsByIndex.end()) {
-            setLastError(QString("New section with index %1 not found").arg(index));
-            return false;
-        }
-
-        int64_t newSectionId = newSectionsByIndex[index];
-
-        // Обновляем future_section_id у старого сечения
-        QString updateOldQuery = QString(
-                                     "UPDATE section SET future_section_id = %1 WHERE id = %2"
-                                     ).arg(newSectionId).arg(oldSectionId);
-
-        db.executeQuery(updateOldQuery);
-
-        // Обновляем past_section_id у нового сечения
-        QString updateNewQuery = QString(
-                                     "UPDATE section SET past_section_id = %1 WHERE id = %2"
-                                     ).arg(oldSectionId).arg(newSectionId);
-
-        db.executeQuery(updateNewQuery);
-
-        linkedCount++;
-        qDebug() << "  Linked section index" << index << ": old_id=" << oldSectionId
-                 << "-> new_id=" << newSectionId;
+    int linkedCount = linkByPairs("section", "future_section_id", "past_section_id", pairs);
+    if (linkedCount == -1) {
+        return false;
     }
 
     qDebug() << "Linked" << linkedCount << "sections";
@@ -1414,71 +2930,45 @@ bool TubeRepository::linkSegments(int64_t oldTubeId, int64_t newTubeId)
 {
     qDebug() << "Linking segments between tubes" << oldTubeId << "and" << newTubeId;
 
-    // Получаем все сегменты старой версии
-    QString oldQuery = QString(
-                           "SELECT id, index FROM segment WHERE tube_id = %1 ORDER BY index"
-                           ).arg(oldTubeId);
-
-    QSqlQuery oldResult = db.executeQuery(oldQuery);
-
-    std::map<int, int64_t> oldSegmentsByIndex;
-    while (oldResult.next()) {
-        int64_t segmentId = oldResult.value(0).toLongLong();
-        int index = oldResult.value(1).toInt();
-        oldSegmentsByIndex[index] = segmentId;
+    // Пары (старый сегмент, новый сегмент) по индексу
+    QString pairs = QString(
+                        "SELECT os.id AS old_id, ns.id AS new_id "
+                        "FROM segment os "
+                        "JOIN segment ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                        "WHERE os.tube_id = %1"
+                        ).arg(oldTubeId).arg(newTubeId);
+
+    // Проверяем, что количество сегментов совпадает и все индексы сопоставлены
+    QString countQuery = QString(
+                             "SELECT (SELECT count(*) FROM segment WHERE tube_id = %1), "
+                             "       (SELECT count(*) FROM segment WHERE tube_id = %2), "
+                             "       (SELECT count(*) FROM (%3) m)"
+                             ).arg(oldTubeId).arg(newTubeId).arg(pairs);
+
+    QSqlQuery countResult = db.executeQuery(countQuery);
+    if (!countResult.next()) {
+        setLastError("Failed to count segments: " + db.getLastError());
+        return false;
     }
 
-    // Получаем все сегменты новой версии
-    QString newQuery = QString(
-                           "SELECT id, index FROM segment WHERE tube_id = %1 ORDER BY index"
-                           ).arg(newTubeId);
-
-    QSqlQuery newResult = db.executeQuery(newQuery);
+    int64_t oldCount = countResult.value(0).toLongLong();
+    int64_t newCount = countResult.value(1).toLongLong();
+    int64_t matchedCount = countResult.value(2).toLongLong();
 
-    std::map<int, int64_t> newSegmentsByIndex;
-    while (newResult.next()) {
-        int64_t segmentId = newResult.value(0).toLongLong();
-        int index = newResult.value(1).toInt();
-        newSegmentsByIndex[index] = segmentId;
+    if (oldCount != newCount) {
+        setLastError(QString("Segment count mismatch: old=%1, new=%2").arg(oldCount).arg(newCount));
+        return false;
     }
 
-    // Проверяем, что количество сегментов совпадает
-    if (oldSegmentsByIndex.size() != newSegmentsByIndex.size()) {
-        setLastError(QString("Segment count mismatch: old=%1, new=%2")
-                         .arg(oldSegmentsByIndex.size()).arg(newSegmentsByIndex.size()));
+    if (matchedCount != oldCount) {
+        setLastError(QString("Only %1 of %2 segments have a matching index in the new version")
+                         .arg(matchedCount).arg(oldCount));
         return false;
     }
 
-    // Связываем сегменты по индексу
-    int linkedCount = 0;
-    for (const auto& pair : oldSegmentsByIndex) {
-        int index = pair.first;
-        int64_t oldSegmentId = pair.second;
-
-        if (newSegmentsByIndex.find(index) == newSegmentsByIndex.end()) {
-            setLastError(QString("New segment with index %1 not found").arg(index));
-            return false;
-        }
-
-        int64_t newSegmentId = newSegmentsByIndex[index];
-
-        // Обновляем future_segment_id у старого сегмента
-        QString updateOldQuery = QString(
-                                     "UPDATE segment SET future_segment_id = %1 WHERE id = %2"
-                                     ).arg(newSegmentId).arg(oldSegmentId);
-
-        db.executeQuery(updateOldQuery);
-
-        // Обновляем past_segment_id у нового сегмента
-        QString updateNewQuery = QString(
-                                     "UPDATE segment SET past_segment_id = %1 WHERE id = %2"
-                                     ).arg(oldSegmentId).arg(newSegmentId);
-
-        db.executeQuery(updateNewQuery);
-
-        linkedCount++;
-        qDebug() << "  Linked segment index" << index << ": old_id=" << oldSegmentId
-                 << "-> new_id=" << newSegmentId;
+    int linkedCount = linkByPairs("segment", "future_segment_id", "past_segment_id", pairs);
+    if (linkedCount == -1) {
+        return false;
     }
 
     qDebug() << "Linked" << linkedCount << "segments";
@@ -1489,95 +2979,55 @@ bool TubeRepository::linkPoints(int64_t oldTubeId, int64_t newTubeId)
 {
     qDebug() << "Linking points between tubes" << oldTubeId << "and" << newTubeId;
 
-    // Получаем маппинг старых и новых section_id
-    std::map<int64_t, int64_t> oldSectionIdToNewSectionId;
-
-    QString sectionQuery = QString(
-                               "SELECT os.id as old_id, ns.id as new_id "
-                               "FROM section os "
-                               "JOIN section ns ON os.index = ns.index "
-                               "WHERE os.tube_id = %1 AND ns.tube_id = %2"
-                               ).arg(oldTubeId).arg(newTubeId);
-
-    QSqlQuery sectionResult = db.executeQuery(sectionQuery);
-    while (sectionResult.next()) {
-        int64_t oldId = sectionResult.value(0).toLongLong();
-        int64_t newId = sectionResult.value(1).toLongLong();
-        oldSectionIdToNewSectionId[oldId] = newId;
-    }
-
-    // Связываем обычные точки (с index_in_section)
-    int linkedRegularPoints = 0;
-    for (const auto& pair : oldSectionIdToNewSectionId) {
-        int64_t oldSectionId = pair.first;
-        int64_t newSectionId = pair.second;
-
-        // Получаем точки старого сечения
-        QString oldPointsQuery = QString(
-                                     "SELECT id, index_in_section FROM point "
-                                     "WHERE section_id = %1 AND index_in_section IS NOT NULL "
-                                     "ORDER BY index_in_section"
-                                     ).arg(oldSectionId);
-
-        QSqlQuery oldPointsResult = db.executeQuery(oldPointsQuery);
-
-        std::map<int, int64_t> oldPointsByIndex;
-        while (oldPointsResult.next()) {
-            int64_t pointId = oldPointsResult.value(0).toLongLong();
-            int index = oldPointsResult.value(1).toInt();
-            oldPointsByIndex[index] = pointId;
-        }
-
-        // Получаем точки нового сечения
-        QString newPointsQuery = QString(
-                                     "SELECT id, index_in_section FROM point "
-                                     "WHERE section_id = %1 AND index_in_section IS NOT NULL "
-                                     "ORDER BY index_in_section"
-                                     ).arg(newSectionId);
-
-        QSqlQuery newPointsResult = db.executeQuery(newPointsQuery);
-
-        std::map<int, int64_t> newPointsByIndex;
-        while (newPointsResult.next()) {
-            int64_t pointId = newPointsResult.value(0).toLongLong();
-            int index = newPointsResult.value(1).toInt();
-            newPointsByIndex[index] = pointId;
-        }
-
-        // Проверяем совпадение количества
-        if (oldPointsByIndex.size() != newPointsByIndex.size()) {
-            setLastError(QString("Point count mismatch in section: old=%1, new=%2")
-                             .arg(oldPointsByIndex.size()).arg(newPointsByIndex.size()));
-            return false;
-        }
-
-        // Связываем точки
-        for (const auto& pointPair : oldPointsByIndex) {
-            int index = pointPair.first;
-            int64_t oldPointId = pointPair.second;
-
-            if (newPointsByIndex.find(index) == newPointsByIndex.end()) {
-                setLastError(QString("New point with index %1 not found in section %2")
-                                 .arg(index).arg(newSectionId));
-                return false;
-            }
+    // Обычные точки (с index_in_section): сечения сопоставляются по index,
+    // точки внутри них - по index_in_section
+    QString pairs = QString(
+                        "SELECT op.id AS old_id, np.id AS new_id "
+                        "FROM section os "
+                        "JOIN section ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                        "JOIN point op ON op.section_id = os.id "
+                        "JOIN point np ON np.section_id = ns.id AND np.index_in_section = op.index_in_section "
+                        "WHERE os.tube_id = %1 AND op.index_in_section IS NOT NULL"
+                        ).arg(oldTubeId).arg(newTubeId);
+
+    // Количество обычных точек в сопоставленных сечениях обеих версий
+    QString countQuery = QString(
+                             "SELECT "
+                             "  (SELECT count(*) FROM section os "
+                             "     JOIN section ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                             "     JOIN point p ON p.section_id = os.id "
+                             "   WHERE os.tube_id = %1 AND p.index_in_section IS NOT NULL), "
+                             "  (SELECT count(*) FROM section ns "
+                             "     JOIN section os ON os.\"index\" = ns.\"index\" AND os.tube_id = %1 "
+                             "     JOIN point p ON p.section_id = ns.id "
+                             "   WHERE ns.tube_id = %2 AND p.index_in_section IS NOT NULL), "
+                             "  (SELECT count(*) FROM (%3) m)"
+                             ).arg(oldTubeId).arg(newTubeId).arg(pairs);
+
+    QSqlQuery countResult = db.executeQuery(countQuery);
+    if (!countResult.next()) {
+        setLastError("Failed to count points: " + db.getLastError());
+        return false;
+    }
 
-            int64_t newPointId = newPointsByIndex[index];
+    int64_t oldCount = countResult.value(0).toLongLong();
+    int64_t newCount = countResult.value(1).toLongLong();
+    int64_t matchedCount = countResult.value(2).toLongLong();
 
-            // Обновляем future_point_id
-            QString updateOldQuery = QString(
-                                         "UPDATE point SET future_point_id = %1 WHERE id = %2"
-                                         ).arg(newPointId).arg(oldPointId);
-            db.executeQuery(updateOldQuery);
+    if (oldCount != newCount) {
+        setLastError(QString("Point count mismatch: old=%1, new=%2").arg(oldCount).arg(newCount));
+        return false;
+    }
 
-            // Обновляем past_point_id
-            QString updateNewQuery = QString(
-                                         "UPDATE point SET past_point_id = %1 WHERE id = %2"
-                                         ).arg(oldPointId).arg(newPointId);
-            db.executeQuery(updateNewQuery);
+    if (matchedCount != oldCount) {
+        setLastError(QString("Only %1 of %2 points have a matching index in the new version")
+                         .arg(matchedCount).arg(oldCount));
+        return false;
+    }
 
-            linkedRegularPoints++;
-        }
+    int linkedRegularPoints = linkByPairs("point", "future_point_id", "past_point_id", pairs);
+    if (linkedRegularPoints == -1) {
+        return false;
     }
 
     qDebug() << "Linked" << linkedRegularPoints << "regular points";
@@ -1598,228 +3048,172 @@ int TubeRepository::linkInterpolatedPoints(int64_t oldTubeId, int64_t newTubeId)
 {
     qDebug() << "Linking interpolated points between tubes" << oldTubeId << "and" << newTubeId;
 
-    // Получаем маппинг segment_id
-    std::map<int, std::pair<int64_t, int64_t>> segmentMapping; // index -> (old_id, new_id)
-
-    QString segmentQuery = QString(
-                               "SELECT os.index, os.id as old_id, ns.id as new_id "
-                               "FROM segment os "
-                               "JOIN segment ns ON os.index = ns.index "
-                               "WHERE os.tube_id = %1 AND ns.tube_id = %2"
-                               ).arg(oldTubeId).arg(newTubeId);
-
-    QSqlQuery segmentResult = db.executeQuery(segmentQuery);
-    while (segmentResult.next()) {
-        int index = segmentResult.value(0).toInt();
-        int64_t oldId = segmentResult.value(1).toLongLong();
-        int64_t newId = segmentResult.value(2).toLongLong();
-        segmentMapping[index] = std::make_pair(oldId, newId);
-    }
-
-    int linkedCount = 0;
-    const float EPSILON = 0.001f;
-
-    // Для каждой пары сегментов связываем интерполированные точки
-    for (const auto& pair : segmentMapping) {
-        int segmentIndex = pair.first;
-        int64_t oldSegmentId = pair.second.first;
-        int64_t newSegmentId = pair.second.second;
-
-        // Получаем интерполированные точки старого сегмента через рёбра
-        QString oldEdgesQuery = QString(
-                                    "SELECT DISTINCT p.id, p.x, p.y, p.z, e.index as edge_index, "
-                                    "  CASE WHEN e.start_point_id = p.id THEN 'start' ELSE 'end' END as point_role "
-                                    "FROM edge e "
-                                    "JOIN point p ON (e.start_point_id = p.id OR e.end_point_id = p.id) "
-                                    "WHERE e.segment_id = %1 AND p.index_in_section IS NULL "
-                                    "ORDER BY e.index, point_role"
-                                    ).arg(oldSegmentId);
-
-        QSqlQuery oldEdgesResult = db.executeQuery(oldEdgesQuery);
-
-        std::vector<std::tuple<int64_t, float, float, float, int, QString>> oldInterpolatedPoints;
-        // (point_id, x, y, z, edge_index, point_role)
-
-        while (oldEdgesResult.next()) {
-            int64_t pointId = oldEdgesResult.value(0).toLongLong();
-            float x = oldEdgesResult.value(1).toFloat();
-            float y = oldEdgesResult.value(2).toFloat();
-            float z = oldEdgesResult.value(3).toFloat();
-            int edgeIndex = oldEdgesResult.value(4).toInt();
-            QString pointRole = oldEdgesResult.value(5).toString();
-
-            oldInterpolatedPoints.push_back(std::make_tuple(pointId, x, y, z, edgeIndex, pointRole));
-        }
-
-        // Получаем интерполированные точки нового сегмента
-        QString newEdgesQuery = QString(
-                                    "SELECT DISTINCT p.id, p.x, p.y, p.z, e.index as edge_index, "
-                                    "  CASE WHEN e.start_point_id = p.id THEN 'start' ELSE 'end' END as point_role "
-                                    "FROM edge e "
-                                    "JOIN point p ON (e.start_point_id = p.id OR e.end_point_id = p.id) "
-                                    "WHERE e.segment_id = %1 AND p.index_in_section IS NULL "
-                                    "ORDER BY e.index, point_role"
-                                    ).arg(newSegmentId);
-
-        QSqlQuery newEdgesResult = db.executeQuery(newEdgesQuery);
-
-        std::vector<std::tuple<int64_t, float, float, float, int, QString>> newInterpolatedPoints;
-
-        while (newEdgesResult.next()) {
-            int64_t pointId = newEdgesResult.value(0).toLongLong();
-            float x = newEdgesResult.value(1).toFloat();
-            float y = newEdgesResult.value(2).toFloat();
-            float z = newEdgesResult.value(3).toFloat();
-            int edgeIndex = newEdgesResult.value(4).toInt();
-            QString pointRole = newEdgesResult.value(5).toString();
-
-            newInterpolatedPoints.push_back(std::make_tuple(pointId, x, y, z, edgeIndex, pointRole));
-        }
-
-        // Связываем точки по их позиции в списке рёбер (edge_index + role)
-        std::map<std::pair<int, QString>, int64_t> oldPointsByEdgeAndRole;
-        std::map<std::pair<int, QString>, int64_t> newPointsByEdgeAndRole;
-
-        for (const auto& tuple : oldInterpolatedPoints) {
-            int64_t pointId = std::get<0>(tuple);
-            int edgeIndex = std::get<4>(tuple);
-            QString role = std::get<5>(tuple);
-            oldPointsByEdgeAndRole[std::make_pair(edgeIndex, role)] = pointId;
-        }
-
-        for (const auto& tuple : newInterpolatedPoints) {
-            int64_t pointId = std::get<0>(tuple);
-            int edgeIndex = std::get<4>(tuple);
-            QString role = std::get<5>(tuple);
-            newPointsByEdgeAndRole[std::make_pair(edgeIndex, role)] = pointId;
-        }
-
-        // Связываем соответствующие точки
-        for (const auto& kvp : oldPointsByEdgeAndRole) {
-            auto key = kvp.first;
-            int64_t oldPointId = kvp.second;
-
-            if (newPointsByEdgeAndRole.find(key) != newPointsByEdgeAndRole.end()) {
-                int64_t newPointId = newPointsByEdgeAndRole[key];
-
-                // Обновляем future_point_id
-                QString updateOldQuery = QString(
-                                             "UPDATE point SET future_point_id = %1 WHERE id = %2"
-                                             ).arg(newPointId).arg(oldPointId);
-                db.executeQuery(updateOldQuery);
-
-                // Обновляем past_point_id
-                QString updateNewQuery = QString(
-                                             "UPDATE point SET past_point_id = %1 WHERE id = %2"
-                                             ).arg(oldPointId).arg(newPointId);
-                db.executeQuery(updateNewQuery);
+    // Интерполированные точки сопоставляются по (индекс сегмента, индекс ребра, роль start/end).
+    // Если точка участвует в нескольких рёбрах, берётся последняя пара в порядке
+    // (сегмент, ребро, роль) - так же, как при прежнем последовательном обновлении.
+    // Запрос переносим между PostgreSQL и SQLite: без LATERAL, DISTINCT ON и приведений ::
+    QString query = QString(
+                        "WITH roles AS ( "
+                        "  SELECT g.tube_id, g.\"index\" AS segment_index, e.\"index\" AS edge_index, "
+                        "         'start' AS role, p.id AS point_id "
+                        "  FROM segment g "
+                        "  JOIN edge e ON e.segment_id = g.id "
+                        "  JOIN point p ON p.id = e.start_point_id "
+                        "  WHERE g.tube_id IN (%1, %2) AND p.index_in_section IS NULL "
+                        "  UNION ALL "
+                        "  SELECT g.tube_id, g.\"index\", e.\"index\", 'end', p.id "
+                        "  FROM segment g "
+                        "  JOIN edge e ON e.segment_id = g.id "
+                        "  JOIN point p ON p.id = e.end_point_id "
+                        "  WHERE g.tube_id IN (%1, %2) AND p.index_in_section IS NULL "
+                        "), pairs AS ( "
+                        "  SELECT o.point_id AS old_id, n.point_id AS new_id, "
+                        "         o.segment_index, o.edge_index, o.role "
+                        "  FROM roles o "
+                        "  JOIN roles n ON n.segment_index = o.segment_index "
+                        "              AND n.edge_index = o.edge_index AND n.role = o.role "
+                        "  WHERE o.tube_id = %1 AND n.tube_id = %2 "
+                        "), ranked AS ( "
+                        "  SELECT old_id, new_id, "
+                        "         row_number() OVER (PARTITION BY old_id "
+                        "             ORDER BY segment_index DESC, edge_index DESC, role DESC) AS old_rank, "
+                        "         row_number() OVER (PARTITION BY new_id "
+                        "             ORDER BY segment_index DESC, edge_index DESC, role DESC) AS new_rank "
+                        "  FROM pairs "
+                        "), links AS ( "
+                        "  SELECT old_id AS id, new_id AS future_id, CAST(NULL AS bigint) AS past_id "
+                        "  FROM ranked WHERE old_rank = 1 "
+                        "  UNION ALL "
+                        "  SELECT new_id AS id, CAST(NULL AS bigint) AS future_id, old_id AS past_id "
+                        "  FROM ranked WHERE new_rank = 1 "
+                        ") "
+                        "UPDATE point AS t "
+                        "SET future_point_id = COALESCE(l.future_id, t.future_point_id), "
+                        "    past_point_id = COALESCE(l.past_id, t.past_point_id) "
+                        "FROM links l "
+                        "WHERE t.id = l.id"
+                        ).arg(oldTubeId).arg(newTubeId);
 
-                linkedCount++;
-
-                qDebug() << "  Linked interpolated point: segment_index=" << segmentIndex
-                         << ", edge_index=" << key.first << ", role=" << key.second
-                         << ", old_id=" << oldPointId << "-> new_id=" << newPointId;
-            }
-        }
+    QSqlQuery result = db.executeQuery(query);
+    if (!result.isActive()) {
+        setLastError("Failed to link interpolated points: " + db.getLastError());
+        return -1;
     }
 
-    return linkedCount;
+    // Обновлены обе стороны связи - старые и новые точки
+    return result.numRowsAffected();
 }
 
 bool TubeRepository::linkEdges(int64_t oldTubeId, int64_t newTubeId)
 {
     qDebug() << "Linking edges between tubes" << oldTubeId << "and" << newTubeId;
 
-    // Получаем маппинг segment_id
-    std::map<int, std::pair<int64_t, int64_t>> segmentMapping; // index -> (old_id, new_id)
-
-    QString segmentQuery = QString(
-                               "SELECT os.index, os.id as old_id, ns.id as new_id "
-                               "FROM segment os "
-                               "JOIN segment ns ON os.index = ns.index "
-                               "WHERE os.tube_id = %1 AND ns.tube_id = %2"
-                               ).arg(oldTubeId).arg(newTubeId);
-
-    QSqlQuery segmentResult = db.executeQuery(segmentQuery);
-    while (segmentResult.next()) {
-        int index = segmentResult.value(0).toInt();
-        int64_t oldId = segmentResult.value(1).toLongLong();
-        int64_t newId = segmentResult.value(2).toLongLong();
-        segmentMapping[index] = std::make_pair(oldId, newId);
+    // Сегменты сопоставляются по index, рёбра внутри них - по index
+    QString pairs = QString(
+                        "SELECT oe.id AS old_id, ne.id AS new_id "
+                        "FROM segment os "
+                        "JOIN segment ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                        "JOIN edge oe ON oe.segment_id = os.id "
+                        "JOIN edge ne ON ne.segment_id = ns.id AND ne.\"index\" = oe.\"index\" "
+                        "WHERE os.tube_id = %1"
+                        ).arg(oldTubeId).arg(newTubeId);
+
+    // Количество рёбер в сопоставленных сегментах обеих версий
+    QString countQuery = QString(
+                             "SELECT "
+                             "  (SELECT count(*) FROM segment os "
+                             "     JOIN segment ns ON ns.\"index\" = os.\"index\" AND ns.tube_id = %2 "
+                             "     JOIN edge e ON e.segment_id = os.id "
+                             "   WHERE os.tube_id = %1), "
+                             "  (SELECT count(*) FROM segment ns "
+                             "     JOIN segment os ON os.\"index\" = ns.\"index\" AND os.tube_id = %1 "
+                             "     JOIN edge e ON e.segment_id = ns.id "
+                             "   WHERE ns.tube_id = %2), "
+                             "  (SELECT count(*) FROM (%3) m)"
+                             ).arg(oldTubeId).arg(newTubeId).arg(pairs);
+
+    QSqlQuery countResult = db.executeQuery(countQuery);
+    if (!countResult.next()) {
+        setLastError("Failed to count edges: " + db.getLastError());
+        return false;
     }
 
-    int linkedCount = 0;
-
-    // Для каждой пары сегментов связываем рёбра
-    for (const auto& pair : segmentMapping) {
-        int segmentIndex = pair.first;
-        int64_t oldSegmentId = pair.second.first;
-        int64_t newSegmentId = pair.second.second;
-
-        // Получаем рёбра старого сегмента
-        QString oldEdgesQuery = QString(
-                                    "SELECT id, index FROM edge WHERE segment_id = %1 ORDER BY index"
-                                    ).arg(oldSegmentId);
-
-        QSqlQuery oldEdgesResult = db.executeQuery(oldEdgesQuery);
+    int64_t oldCount = countResult.value(0).toLongLong();
+    int64_t newCount = countResult.value(1).toLongLong();
+    int64_t matchedCount = countResult.value(2).toLongLong();
 
-        std::map<int, int64_t> oldEdgesByIndex;
-        while (oldEdgesResult.next()) {
-            int64_t edgeId = oldEdgesResult.value(0).toLongLong();
-            int index = oldEdgesResult.value(1).toInt();
-            oldEdgesByIndex[index] = edgeId;
-        }
-
-        // Получаем рёбра нового сегмента
-        QString newEdgesQuery = QString(
-                                    "SELECT id, index FROM edge WHERE segment_id = %1 ORDER BY index"
-                                    ).arg(newSegmentId);
+    if (oldCount != newCount) {
+        setLastError(QString("Edge count mismatch: old=%1, new=%2").arg(oldCount).arg(newCount));
+        return false;
+    }
 
-        QSqlQuery newEdgesResult = db.executeQuery(newEdgesQuery);
+    if (matchedCount != oldCount) {
+        setLastError(QString("Only %1 of %2 edges have a matching index in the new version")
+                         .arg(matchedCount).arg(oldCount));
+        return false;
+    }
 
-        std::map<int, int64_t> newEdgesByIndex;
-        while (newEdgesResult.next()) {
-            int64_t edgeId = newEdgesResult.value(0).toLongLong();
-            int index = newEdgesResult.value(1).toInt();
-            newEdgesByIndex[index] = edgeId;
-        }
+    int linkedCount = linkByPairs("edge", "future_edge_id", "past_edge_id", pairs);
+    if (linkedCount == -1) {
+        return false;
+    }
 
-        // Проверяем совпадение количества
-        if (oldEdgesByIndex.size() != newEdgesByIndex.size()) {
-            setLastError(QString("Edge count mismatch in segment %1: old=%2, new=%3")
-                             .arg(segmentIndex).arg(oldEdgesByIndex.size()).arg(newEdgesByIndex.size()));
-            return false;
-        }
+    qDebug() << "Linked" << linkedCount << "edges";
+    return true;
+}
 
-        // Связываем рёбра
-        for (const auto& edgePair : oldEdgesByIndex) {
-            int index = edgePair.first;
-            int64_t oldEdgeId = edgePair.second;
+bool TubeRepository::updateTubeLength(int64_t tubeId)
+{
+    // То же правило, что в recalculate_tube_lengths: сумма max(beg_sz) по сегментам
+    QString query = QString(
+                        "UPDATE tube SET len = ("
+                        "  SELECT COALESCE(SUM(m.max_edge_length), 0) FROM ("
+                        "    SELECT MAX(e.beg_sz) AS max_edge_length "
+                        "    FROM segment s LEFT JOIN edge e ON e.segment_id = s.id "
+                        "    WHERE s.tube_id = %1 GROUP BY s.id"
+                        "  ) m"
+                        ") WHERE id = %1"
+                        ).arg(tubeId);
 
-            if (newEdgesByIndex.find(index) == newEdgesByIndex.end()) {
-                setLastError(QString("New edge with index %1 not found in segment %2")
-                                 .arg(index).arg(newSegmentId));
-                return false;
-            }
+    if (!db.execute(query)) {
+        setLastError(db.getLastError());
+        return false;
+    }
+    return true;
+}
 
-            int64_t newEdgeId = newEdgesByIndex[index];
+int TubeRepository::linkByPairs(const QString& table, const QString& futureColumn,
+                                const QString& pastColumn, const QString& pairsQuery)
+{
+    // future_* у старых строк
+    QString updateOld = QString(
+                            "UPDATE %1 AS t SET %2 = m.new_id FROM (%3) AS m WHERE t.id = m.old_id"
+                            ).arg(table, futureColumn, pairsQuery);
+
+    QSqlQuery oldResult = db.executeQuery(updateOld);
+    if (!oldResult.isActive()) {
+        setLastError(QString("Failed to update %1 in %2: %3")
+                         .arg(futureColumn, table, db.getLastError()));
+        return -1;
+    }
 
-            // Обновляем future_edge_id
-            QString updateOldQuery = QString(
-                                         "UPDATE edge SET future_edge_id = %1 WHERE id = %2"
-                                         ).arg(newEdgeId).arg(oldEdgeId);
-            db.executeQuery(updateOldQuery);
+    // past_* у новых строк
+    QString updateNew = QString(
+                            "UPDATE %1 AS t SET %2 = m.old_id FROM (%3) AS m WHERE t.id = m.new_id"
+                            ).arg(table, pastColumn, pairsQuery);
 
-            // Обновляем past_edge_id
-            QString updateNewQuery = QString(
-                                         "UPDATE edge SET past_edge_id = %1 WHERE id = %2"
-                                         ).arg(oldEdgeId).arg(newEdgeId);
-            db.executeQuery(updateNewQuery);
+    QSqlQuery newResult = db.executeQuery(updateNew);
+    if (!newResult.isActive()) {
+        setLastError(QString("Failed to update %1 in %2: %3")
+                         .arg(pastColumn, table, db.getLastError()));
+        return -1;
+    }
 
-            linkedCount++;
-        }
+    if (oldResult.numRowsAffected() != newResult.numRowsAffected()) {
+        setLastError(QString("Link update mismatch in %1: %2 old rows, %3 new rows")
+                         .arg(table).arg(oldResult.numRowsAffected()).arg(newResult.numRowsAffected()));
+        return -1;
     }
 
-    qDebug() << "Linked" << linkedCount << "edges";
-    return true;
+    return oldResult.numRowsAffected();
 }
@@ -8,60 +8,245 @@
 #include "edge.h"
 #include "point3d.h"
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include <QString>
+#include <QByteArray>
 #include <QDebug>
 
+class SectionCenterGrid;
+
 class TubeRepository
 {
 public:
+    // Режим записи трубки: построчные INSERT или пакетная запись всей таблицы за один запрос
+    enum class SaveMode {
+        PerRow,
+        Batched,  // многострочные INSERT ... VALUES (...),(...) RETURNING для точек и рёбер
+        Bulk
+    };
+
+    // Режим загрузки: прежний построчный или фиксированное число запросов
+    enum class LoadMode {
+        PerRow,
+        Batched
+    };
+
+    // Способ хранения новых версий: полный снимок или только сдвинутые точки
+    enum class VersionStorage {
+        Snapshot,
+        Delta
+    };
+
     TubeRepository();
+    // Работа через указанное соединение (например, из фонового потока)
+    explicit TubeRepository(DatabaseManager& database);
     ~TubeRepository();
 
-    int64_t saveTube(const Tube& tube, int verId, int64_t previousTubeId = -1);
+    // previousTube - версия previousTubeId в том виде, в каком её восстанавливает загрузка
+    // (а не трубка, переданная в прошлый saveTube): без него дельту не с чем сравнить
+    // и пишется полный снимок. В storedTube (если задан) возвращается так же восстановленная
+    // новая версия - её и нужно передавать как previousTube следующего сохранения, иначе
+    // сдвиги меньше deltaEpsilon копятся незаписанными до ближайшего снимка
+    int64_t saveTube(const Tube& tube, int verId, int64_t previousTubeId = -1,
+                     SaveMode mode = SaveMode::PerRow, const Tube* previousTube = nullptr,
+                     Tube* storedTube = nullptr);
 
     QString getLastError() const;
 
+    // Максимальное число строк в одном многострочном INSERT (режим Batched)
+    void setInsertBatchSize(int rows);
+    int getInsertBatchSize() const;
+
+    // Дельта-хранение: версия с той же топологией хранит только точки,
+    // сдвинувшиеся больше чем на epsilon; иначе пишется полный снимок
+    void setVersionStorage(VersionStorage storage);
+    void setDeltaEpsilon(float epsilon);
+
+    // Каждая N-я версия дельта-цепочки пишется полным снимком (0 - без ограничения),
+    // так что загрузка любой версии применяет не больше N - 1 дельт
+    void setKeyframeInterval(int interval);
+
+    // Дополнительно хранить контур сечения одним bytea (little-endian float32 x, y, z);
+    // загрузчик читает контуры из него, строки point остаются для рёбер и связей версий
+    void setPackedGeometry(bool enabled);
+
+    // Отложить пересчёт tube.len триггерами до commit транзакции saveTube
+    void setDeferLengthUpdates(bool enabled);
+
     bool linkTubeVersions(int64_t oldTubeId, int64_t newTubeId);
 
     int64_t getPastTubeId(int64_t tubeId);
     int64_t getFutureTubeId(int64_t tubeId);
-    bool loadTubeById(int64_t tubeId, Tube& tube);
+    bool loadTubeById(int64_t tubeId, Tube& tube, LoadMode mode = LoadMode::Batched);
+
+    // Время последней загрузки loadTubeById в миллисекундах и ver_id загруженной трубки
+    qint64 getLastLoadTimeMs() const;
+    int getLastLoadedVerId() const;
     bool deleteFutureVersions(int64_t fromTubeId);
 
+    // Вся цепочка версий, в которую входит tubeId, от самой старой к самой новой
+    struct VersionInfo {
+        int64_t tubeId;
+        int verId;
+        bool isDelta;
+    };
+    std::vector<VersionInfo> getVersionHistory(int64_t tubeId);
+
+    // Изменения между двумя версиями без загрузки трубок: смещения контурных точек
+    // и сдвиги центров сечений. Параллельные массивы по возрастанию индексов,
+    // смещения хранятся подряд: dx, dy, dz на элемент
+    struct VersionDiff {
+        std::vector<int> pointSectionIndices;
+        std::vector<int> pointIndices;
+        std::vector<float> pointDisplacements;
+        std::vector<int> sectionIndices;
+        std::vector<float> centerShifts;
+
+        float maxDisplacement = 0.0f;
+        float meanDisplacement = 0.0f;
+        int maxDisplacementSection = -1;
+        int maxDisplacementPoint = -1;
+        // Точки, сдвинувшиеся больше чем на deltaEpsilon
+        int movedPointCount = 0;
+    };
+    // Один запрос; версии могут быть любыми (не обязательно соседними), в т.ч. дельтами
+    bool diffVersions(int64_t oldTubeId, int64_t newTubeId, VersionDiff& diff);
+
+    // Сущности дельта-версии - строки её базового снимка: ключевой снимок после дельты
+    // связывается с ними; для новой дельта-версии связывать нечего
     bool linkVersionEntities(int64_t oldTubeId, int64_t newTubeId);
 
+    // Пространственные запросы по центрам сечений всех трубок и версий без загрузки трубок.
+    // PostgreSQL - индексы GiST по section (снимки) и delta_section_center: у дельта-версии
+    // своих строк section нет, поэтому при её сохранении центры всех сечений пишутся
+    // отдельно (sectionId - строка базового снимка). Без индекса - сетка в памяти,
+    // общая для процесса и перестраиваемая после записи; дельты такие СУБД не хранят
+    struct SectionLocation {
+        int64_t sectionId;
+        int64_t tubeId;
+        int sectionIndex;
+        Point3D center;
+    };
+    // Сечения с центром внутри параллелепипеда (границы включаются), по tube_id и индексу
+    std::vector<SectionLocation> findSectionsInBox(const Point3D& minCorner, const Point3D& maxCorner);
+
+    struct TubeProximity {
+        int64_t tubeId;
+        float distance;
+    };
+    // Трубки, осевая линия которых (ломаная по центрам сечений) проходит ближе radius к точке,
+    // по возрастанию расстояния
+    std::vector<TubeProximity> findTubesNearPoint(const Point3D& point, float radius);
+
+    // Кандидаты ищутся по центрам в кубе radius + margin: звено оси длиннее 2 * margin,
+    // оба конца которого вне куба, может быть пропущено
+    void setSpatialSearchMargin(float margin);
+    // Сбросить общую сетку центров (после записи в БД в обход TubeRepository)
+    void invalidateSpatialCache();
+
 private:
     DatabaseManager& db;
     QString lastError;
+    qint64 lastLoadTimeMs;
+    int lastLoadedVerId;
+    int insertBatchSize;
+
+    VersionStorage versionStorage;
+    float deltaEpsilon;
+    int keyframeInterval;
+    bool packedGeometry;
+    bool deferLengthUpdates;
+    float spatialSearchMargin;
+
+    static constexpr int DEFAULT_INSERT_BATCH_SIZE = 500;
+    static constexpr int MAX_INSERT_BATCH_SIZE = 5000;
+    static constexpr float DEFAULT_DELTA_EPSILON = 1e-5f;
+    static constexpr int DEFAULT_KEYFRAME_INTERVAL = 10;
+    // Половина стандартного шага между сечениями (100)
+    static constexpr float DEFAULT_SPATIAL_SEARCH_MARGIN = 50.0f;
+
+    // Значения tube.storage_kind
+    static constexpr int STORAGE_SNAPSHOT = 0;
+    static constexpr int STORAGE_DELTA = 1;
+
+    struct PointDelta {
+        int sectionIndex;
+        int indexInSection;
+        Point3D point;
+    };
+
+    // Координаты, квантованные с шагом POINT_KEY_STEP
+    struct PointKey {
+        int64_t x;
+        int64_t y;
+        int64_t z;
+
+        bool operator==(const PointKey& other) const
+        {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+    struct PointKeyHash {
+        size_t operator()(const PointKey& key) const;
+    };
 
-    using PointKey = std::tuple<float, float, float>;
+    static constexpr float POINT_KEY_STEP = 0.001f;
+
+    // id по индексу (сечения, точки, сегмента, ребра); -1 - нет
+    using IdByIndex = std::vector<int64_t>;
+
+    // id сохранённых точек трубки: точки контура по (индекс сечения, индекс в сечении),
+    // остальные (интерполированные, рёбра без индексов) - по квантованным координатам
+    struct PointIdIndex {
+        std::vector<IdByIndex> bySection;
+        std::unordered_map<PointKey, int64_t, PointKeyHash> byCoordinates;
+        size_t count = 0;
+    };
+
+    static int64_t idAtIndex(const IdByIndex& ids, int index);
+    static void setIdAtIndex(IdByIndex& ids, int index, int64_t id);
 
     int64_t insertTubeRecord(int verId);
-    bool saveSections(int64_t tubeId, const Tube& tube, int verId,
-                                      std::map<PointKey, int64_t>& pointIdsMap);
-    bool saveSegments(int64_t tubeId, const Tube& tube, int verId,
-                                      const std::map<PointKey, int64_t>& pointIdsMap);
-
-    int64_t insertSection(int64_t tubeId, const Section& section, int verId, int index);
-    bool savePoints(int64_t sectionId, const Section& section, int verId,
-                                    std::map<PointKey, int64_t>& pointIdsMap);
-    int64_t insertPoint(int64_t sectionId, const Point3D& point, int verId,
-                        int indexInSection);
-
-    int64_t insertSegment(int64_t tubeId, const Segment& segment, int verId, int index);
-    bool saveEdges(int64_t segmentId, const Segment& segment, int verId,
-                                   const std::map<PointKey, int64_t>& pointIdsMap);
-    int64_t insertEdge(int64_t segmentId, const Edge& edge, int verId, int index,
-                       int64_t startPointId, int64_t endPointId);
-
-    int64_t findPointId(const Point3D& point,
-                                        const std::map<PointKey, int64_t>& pointIdsMap) const;
+
+    bool loadTubeByIdBatched(int64_t tubeId, Tube& tube);
+    bool loadTubeByIdPerRow(int64_t tubeId, Tube& tube);
+    bool loadSnapshotBatched(int64_t tubeId, Tube& tube);
+    bool readTubeHeader(int64_t tubeId, int& verId, int& storageKind);
+
+    bool collectPointDeltas(const Tube& baseTube, const Tube& tube,
+                            std::vector<PointDelta>& deltas) const;
+    // storedTube - версия в том виде, в каком её восстановит загрузка (для центров сечений)
+    int64_t saveTubeDelta(int verId, int64_t baseTubeId, const std::vector<PointDelta>& deltas,
+                          const Tube& storedTube);
+    static void applyPointDeltas(Tube& tube, const std::vector<PointDelta>& deltas);
+    bool loadDeltaChain(int64_t tubeId, Tube& tube);
+    int getDeltaChainDepth(int64_t tubeId);
+    // id полного снимка, строки которого использует версия (для снимка - она сама)
+    int64_t getSnapshotTubeId(int64_t tubeId);
+
+    QByteArray packContour(const Section& section) const;
+    bool unpackContour(const QByteArray& blob, Section& section) const;
+
+    // Размеры bySection и резерв хеш-таблицы - по числу точек трубки
+    void resetPointIdIndex(const Tube& tube, PointIdIndex& pointIds) const;
+    // indexInSection = -1 - точка без индекса (только по координатам)
+    void addPointId(PointIdIndex& pointIds, int sectionIndex, int indexInSection,
+                    const Point3D& point, int64_t id) const;
+    int64_t findPointId(const PointIdIndex& pointIds, int sectionIndex, int indexInSection,
+                        const Point3D& point) const;
     bool validateTubeData(const Tube& tube) const;
     void setLastError(const QString& error);
 
     PointKey makePointKey(const Point3D& point) const;
 
-    bool loadOldSectionIds(int64_t tubeId, std::map<int, int64_t>& sectionIndexToId);
+    // Привязка ссылки: -1 -> NULL
+    QVariant idOrNull(int64_t id) const;
+    bool setFutureId(const QString& table, int64_t oldId, int64_t newId);
+
+    bool loadOldSectionIds(int64_t tubeId, IdByIndex& sectionIndexToId);
 
     // Сохранение с версионностью
     bool saveSectionsWithVersioning(
@@ -69,34 +254,60 @@ private:
         const Tube& tube,
         int verId,
         int64_t previousTubeId,
-        std::map<PointKey, int64_t>& pointIdsMap,
-        std::map<int, int64_t>& sectionIndexToNewId,
-        std::map<int, int64_t>& sectionIndexToOldId,
-        std::map<int64_t, int64_t>& oldPointIdToNewPointId);
+        PointIdIndex& pointIds,
+        const IdByIndex& sectionIndexToOldId,
+        SaveMode mode);
 
     bool savePointsWithVersioning(
         int64_t newSectionId,
         int64_t oldSectionId,
         const Section& section,
         int verId,
-        std::map<PointKey, int64_t>& pointIdsMap,
-        std::map<int64_t, int64_t>& oldPointIdToNewPointId);
+        PointIdIndex& pointIds,
+        SaveMode mode);
 
     bool saveSegmentsWithVersioning(
         int64_t tubeId,
         const Tube& tube,
         int verId,
         int64_t previousTubeId,
-        const std::map<PointKey, int64_t>& pointIdsMap,
-        const std::map<int64_t, int64_t>& oldPointIdToNewPointId);
+        const PointIdIndex& pointIds,
+        SaveMode mode);
 
     bool saveEdgesWithVersioning(
         int64_t newSegmentId,
         int64_t oldSegmentId,
         const Segment& segment,
         int verId,
-        const std::map<PointKey, int64_t>& pointIdsMap,
-        const std::map<int64_t, int64_t>& oldPointIdToNewPointId);
+        const PointIdIndex& pointIds,
+        SaveMode mode);
+
+    // Пакетное сохранение: id резервируются через nextval, каждая таблица пишется одним INSERT ... unnest
+    bool saveTubeBulk(int64_t tubeId, const Tube& tube, int verId, int64_t previousTubeId);
+
+    QString makeBigintArray(const std::vector<int64_t>& values) const;
+    QString makeIntArray(const std::vector<int>& values) const;
+    QString makeRealArray(const std::vector<float>& values) const;
+    bool linkFutureIdsBulk(const QString& table, const QString& futureColumn,
+                           const std::vector<int64_t>& oldIds,
+                           const std::vector<int64_t>& newIds);
+
+    // Многострочная вставка точек и рёбер пачками по insertBatchSize
+    bool savePointsBatched(
+        int64_t newSectionId,
+        const Section& section,
+        int verId,
+        const IdByIndex& oldPointIndices,
+        PointIdIndex& pointIds);
+
+    bool saveEdgesBatched(
+        int64_t newSegmentId,
+        const Segment& segment,
+        int verId,
+        const IdByIndex& oldEdgeIds,
+        const PointIdIndex& pointIds);
+
+    QString makeValuesPlaceholders(int rows, int columns) const;
 
     // Вставка с указанием past_id
     int64_t insertSectionWithPast(
@@ -134,6 +345,19 @@ private:
     bool linkPoints(int64_t oldTubeId, int64_t newTubeId);
     int linkInterpolatedPoints(int64_t oldTubeId, int64_t newTubeId);
     bool linkEdges(int64_t oldTubeId, int64_t newTubeId);
+
+    // Пересчёт длины трубки, если СУБД не делает этого триггерами
+    bool updateTubeLength(int64_t tubeId);
+
+    // Сетка центров сечений из общего кэша; строится при первом запросе после записи
+    // (бэкенды без пространственного индекса). nullptr при ошибке
+    std::shared_ptr<const SectionCenterGrid> getSectionGrid();
+    // Расстояние от точки до ломаной; для одной вершины - до неё самой
+    static float distanceToPolyline(const Point3D& point, const std::vector<Point3D>& polyline);
+
+    // Два UPDATE ... FROM по подзапросу пар (old_id, new_id); возвращает число связанных строк или -1
+    int linkByPairs(const QString& table, const QString& futureColumn,
+                    const QString& pastColumn, const QString& pairsQuery);
 };
 
 #endif
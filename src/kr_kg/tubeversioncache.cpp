@@ -0,0 +1,127 @@
+#include "tubeversioncache.h"
+#include <QDebug>
+
+TubeVersionCache::TubeVersionCache(size_t byteBudget)
+    : byteBudget(byteBudget)
+    , usedBytes(0)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+{
+}
+
+std::shared_ptr<const TubeVersionCache::Entry> TubeVersionCache::get(int64_t tubeId)
+{
+    auto it = entries.find(tubeId);
+    if (it == entries.end()) {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    recency.splice(recency.begin(), recency, it->second.position);
+    return it->second.entry;
+}
+
+std::shared_ptr<const TubeVersionCache::Entry> TubeVersionCache::peek(int64_t tubeId) const
+{
+    auto it = entries.find(tubeId);
+    return it != entries.end() ? it->second.entry : nullptr;
+}
+
+bool TubeVersionCache::contains(int64_t tubeId) const
+{
+    return entries.find(tubeId) != entries.end();
+}
+
+void TubeVersionCache::put(int64_t tubeId, std::shared_ptr<const Entry> entry)
+{
+    if (!entry) {
+        return;
+    }
+
+    invalidate(tubeId);
+
+    size_t bytes = estimateBytes(*entry);
+    if (bytes > byteBudget) {
+        qDebug() << "TubeVersionCache: tube" << tubeId << "(" << bytes << "bytes) exceeds the cache budget";
+        return;
+    }
+
+    recency.push_front(tubeId);
+    entries[tubeId] = {std::move(entry), bytes, recency.begin()};
+    usedBytes += bytes;
+
+    evictToBudget();
+}
+
+void TubeVersionCache::invalidate(int64_t tubeId)
+{
+    auto it = entries.find(tubeId);
+    if (it != entries.end()) {
+        removeSlot(it);
+    }
+}
+
+void TubeVersionCache::invalidateFutureOf(int64_t tubeId)
+{
+    int64_t id = tubeId;
+    while (id != -1) {
+        auto it = entries.find(id);
+        if (it == entries.end()) {
+            break;
+        }
+        int64_t nextId = it->second.entry->futureTubeId;
+        removeSlot(it);
+        id = nextId;
+    }
+}
+
+void TubeVersionCache::clear()
+{
+    entries.clear();
+    recency.clear();
+    usedBytes = 0;
+}
+
+void TubeVersionCache::setByteBudget(size_t bytes)
+{
+    byteBudget = bytes;
+    evictToBudget();
+}
+
+size_t TubeVersionCache::estimateBytes(const Entry& entry)
+{
+    size_t bytes = sizeof(Entry);
+
+    for (const Section& section : entry.tube.getSections()) {
+        bytes += sizeof(Section) + section.getPointCount() * (sizeof(Point3D) + sizeof(int));
+    }
+    for (const Segment& segment : entry.tube.segments) {
+        bytes += sizeof(Segment) + segment.getConnectingEdgeCount() * sizeof(Edge);
+    }
+
+    const Tube::TubeMesh& mesh = entry.mesh;
+    bytes += mesh.vertices.capacity() * sizeof(Point3D);
+    bytes += mesh.edges.capacity() * sizeof(std::pair<int, int>);
+    bytes += mesh.faces.capacity() * sizeof(std::array<int, 3>);
+    bytes += (mesh.sectionStartIndices.capacity() + mesh.pointsPerSection.capacity()) * sizeof(int);
+
+    return bytes;
+}
+
+void TubeVersionCache::evictToBudget()
+{
+    while (usedBytes > byteBudget && !recency.empty()) {
+        int64_t victim = recency.back();
+        removeSlot(entries.find(victim));
+        evictions++;
+    }
+}
+
+void TubeVersionCache::removeSlot(std::map<int64_t, Slot>::iterator it)
+{
+    usedBytes -= it->second.bytes;
+    recency.erase(it->second.position);
+    entries.erase(it);
+}
@@ -0,0 +1,75 @@
+#ifndef TUBEVERSIONCACHE_H
+#define TUBEVERSIONCACHE_H
+
+#include "tube.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+
+// LRU-кэш загруженных версий трубки (ключ - tube_id).
+// Хранит восстановленную трубку вместе с построенной сеткой и связями версий,
+// чтобы переход назад/вперёд по недавним версиям не обращался к БД.
+// Объём ограничен приблизительным числом байт.
+class TubeVersionCache
+{
+public:
+    struct Entry {
+        Tube tube;
+        Tube::TubeMesh mesh;
+        bool meshValid = false;
+        int verId = 0;
+        int64_t pastTubeId = -1;
+        int64_t futureTubeId = -1;
+    };
+
+    explicit TubeVersionCache(size_t byteBudget = DEFAULT_BYTE_BUDGET);
+
+    // Возвращает запись и поднимает её в начало очереди; nullptr при промахе
+    std::shared_ptr<const Entry> get(int64_t tubeId);
+    // Без обновления LRU-порядка и счётчиков
+    std::shared_ptr<const Entry> peek(int64_t tubeId) const;
+    bool contains(int64_t tubeId) const;
+
+    void put(int64_t tubeId, std::shared_ptr<const Entry> entry);
+
+    void invalidate(int64_t tubeId);
+    // Удаляет tubeId и все закэшированные версии, достижимые из него по future-связям
+    void invalidateFutureOf(int64_t tubeId);
+    void clear();
+
+    void setByteBudget(size_t bytes);
+    size_t getByteBudget() const { return byteBudget; }
+    size_t getUsedBytes() const { return usedBytes; }
+    size_t getEntryCount() const { return entries.size(); }
+
+    int64_t getHitCount() const { return hits; }
+    int64_t getMissCount() const { return misses; }
+    int64_t getEvictionCount() const { return evictions; }
+
+    static size_t estimateBytes(const Entry& entry);
+
+private:
+    struct Slot {
+        std::shared_ptr<const Entry> entry;
+        size_t bytes;
+        std::list<int64_t>::iterator position;
+    };
+
+    static const size_t DEFAULT_BYTE_BUDGET = 64 * 1024 * 1024;
+
+    void evictToBudget();
+    void removeSlot(std::map<int64_t, Slot>::iterator it);
+
+    std::map<int64_t, Slot> entries;
+    // Начало списка - последние использованные версии
+    std::list<int64_t> recency;
+    size_t byteBudget;
+    size_t usedBytes;
+    int64_t hits;
+    int64_t misses;
+    int64_t evictions;
+};
+
+#endif // TUBEVERSIONCACHE_H
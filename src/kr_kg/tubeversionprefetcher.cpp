@@ -0,0 +1,217 @@
+#include "tubeversionprefetcher.h"
+#include "tuberepository.h"
+#include "connectionpool.h"
+#include <QSemaphore>
+#include <QDebug>
+
+TubeVersionPrefetcher::TubeVersionPrefetcher(TubeVersionCache& cache, QObject *parent)
+    : QObject(parent)
+    , cache(cache)
+    , generation(0)
+    , depth(DEFAULT_DEPTH)
+    , byteBudget(DEFAULT_BYTE_BUDGET)
+    , hits(0)
+    , misses(0)
+    , wasted(0)
+{
+    threadPool.setMaxThreadCount(PREFETCH_THREADS);
+    // Потоки не завершаются по простою: соединения пула привязаны к потоку
+    threadPool.setExpiryTimeout(-1);
+}
+
+TubeVersionPrefetcher::~TubeVersionPrefetcher()
+{
+    // Прерываем цепочки загрузок и дожидаемся выполняющихся задач
+    generation++;
+    threadPool.waitForDone();
+
+    // Свободные соединения пула привязаны к потокам предзагрузки и закрываться должны в них же.
+    // Задачи не завершаются, пока не запустятся все, поэтому каждая занимает свой поток
+    const int threads = threadPool.maxThreadCount();
+    QSemaphore started;
+    QSemaphore proceed;
+    for (int i = 0; i < threads; ++i) {
+        threadPool.start([&started, &proceed]() {
+            started.release();
+            proceed.acquire();
+            DatabaseManager::getConnectionPool().releaseCurrentThreadConnections();
+        });
+    }
+    started.acquire(threads);
+    proceed.release(threads);
+    threadPool.waitForDone();
+
+    qDebug() << "TubeVersionPrefetcher: hits" << hits << "misses" << misses << "wasted" << wasted;
+}
+
+void TubeVersionPrefetcher::setDepth(int depth)
+{
+    this->depth = depth < 0 ? 0 : depth;
+}
+
+void TubeVersionPrefetcher::setByteBudget(size_t bytes)
+{
+    byteBudget = bytes;
+}
+
+void TubeVersionPrefetcher::prefetchAround(int64_t tubeId)
+{
+    forgetEvicted();
+
+    for (bool future : {false, true}) {
+        // Проходим по уже закэшированным версиям до первой отсутствующей
+        int64_t id = tubeId;
+        for (int distance = 1; distance <= depth; ++distance) {
+            std::shared_ptr<const TubeVersionCache::Entry> entry = cache.peek(id);
+            if (!entry) {
+                break;
+            }
+
+            int64_t nextId = future ? entry->futureTubeId : entry->pastTubeId;
+            if (nextId == -1) {
+                break;
+            }
+
+            if (!cache.contains(nextId)) {
+                schedule(nextId, future, depth - distance + 1);
+                break;
+            }
+            id = nextId;
+        }
+    }
+}
+
+void TubeVersionPrefetcher::recordNavigation(int64_t tubeId)
+{
+    forgetEvicted();
+
+    auto it = prefetchedUnused.find(tubeId);
+    if (it != prefetchedUnused.end()) {
+        hits++;
+        prefetchedUnused.erase(it);
+    } else if (!cache.contains(tubeId)) {
+        misses++;
+    }
+}
+
+void TubeVersionPrefetcher::invalidate()
+{
+    generation++;
+}
+
+void TubeVersionPrefetcher::schedule(int64_t startTubeId, bool future, int steps)
+{
+    if (steps <= 0 || inFlight.count(startTubeId) > 0) {
+        return;
+    }
+
+    inFlight.insert(startTubeId);
+    int generationAtStart = generation.load();
+
+    qDebug() << "TubeVersionPrefetcher: prefetching" << steps << (future ? "future" : "past")
+             << "versions from tube" << startTubeId;
+
+    threadPool.start([this, startTubeId, future, steps, generationAtStart]() {
+        runPrefetch(startTubeId, future, steps, generationAtStart);
+    });
+}
+
+void TubeVersionPrefetcher::runPrefetch(int64_t startTubeId, bool future, int steps, int generationAtStart)
+{
+    // Выполняется в потоке пула: к кэшу не обращаемся, результаты передаём в GUI-поток
+    ConnectionPool::Guard connection = DatabaseManager::getConnectionPool().acquire(CONNECTION_TIMEOUT_MS);
+
+    if (connection.isValid()) {
+        TubeRepository repository(*connection);
+        int64_t id = startTubeId;
+
+        for (int step = 0; step < steps && id != -1; ++step) {
+            if (generation.load() != generationAtStart) {
+                break;
+            }
+
+            std::shared_ptr<TubeVersionCache::Entry> entry = std::make_shared<TubeVersionCache::Entry>();
+            if (!repository.loadTubeById(id, entry->tube)) {
+                qDebug() << "TubeVersionPrefetcher: failed to load tube" << id << ":" << repository.getLastError();
+                break;
+            }
+
+            entry->verId = repository.getLastLoadedVerId();
+            entry->pastTubeId = repository.getPastTubeId(id);
+            entry->futureTubeId = repository.getFutureTubeId(id);
+
+            Tube::TubeConstructionResult meshResult = entry->tube.buildMesh();
+            entry->meshValid = meshResult.success;
+            if (meshResult.success) {
+                entry->mesh = std::move(meshResult.mesh);
+            }
+
+            std::shared_ptr<const TubeVersionCache::Entry> ready = entry;
+            QMetaObject::invokeMethod(this, [this, id, ready, generationAtStart]() {
+                storePrefetched(id, ready, generationAtStart);
+            }, Qt::QueuedConnection);
+
+            id = future ? entry->futureTubeId : entry->pastTubeId;
+        }
+    }
+
+    QMetaObject::invokeMethod(this, [this, startTubeId]() {
+        finishPrefetch(startTubeId);
+    }, Qt::QueuedConnection);
+}
+
+void TubeVersionPrefetcher::storePrefetched(int64_t tubeId,
+                                            std::shared_ptr<const TubeVersionCache::Entry> entry,
+                                            int generationAtStart)
+{
+    // Пока версия грузилась, кэш был сброшен - связи могли устареть
+    if (generationAtStart != generation.load()) {
+        wasted++;
+        return;
+    }
+
+    if (cache.contains(tubeId)) {
+        return;
+    }
+
+    forgetEvicted();
+
+    size_t bytes = TubeVersionCache::estimateBytes(*entry);
+    if (unusedPrefetchedBytes() + bytes > byteBudget) {
+        qDebug() << "TubeVersionPrefetcher: budget exceeded, dropping tube" << tubeId;
+        wasted++;
+        return;
+    }
+
+    cache.put(tubeId, std::move(entry));
+    if (cache.contains(tubeId)) {
+        prefetchedUnused[tubeId] = bytes;
+    }
+}
+
+void TubeVersionPrefetcher::finishPrefetch(int64_t startTubeId)
+{
+    inFlight.erase(startTubeId);
+}
+
+void TubeVersionPrefetcher::forgetEvicted()
+{
+    // Предзагруженные версии, вытесненные или сброшенные до использования
+    for (auto it = prefetchedUnused.begin(); it != prefetchedUnused.end();) {
+        if (!cache.contains(it->first)) {
+            wasted++;
+            it = prefetchedUnused.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t TubeVersionPrefetcher::unusedPrefetchedBytes() const
+{
+    size_t total = 0;
+    for (const auto& entry : prefetchedUnused) {
+        total += entry.second;
+    }
+    return total;
+}
@@ -0,0 +1,77 @@
+#ifndef TUBEVERSIONPREFETCHER_H
+#define TUBEVERSIONPREFETCHER_H
+
+#include "tubeversioncache.h"
+#include <QObject>
+#include <QThreadPool>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <map>
+#include <set>
+
+// Упреждающая загрузка соседних версий трубки.
+// После каждого перехода загружает (и строит сетку) past/future версии на заданную глубину
+// в пуле потоков, готовые записи кладутся в TubeVersionCache в GUI-потоке.
+// Результаты, полученные до сброса кэша (сохранение, удаление будущих версий), отбрасываются.
+class TubeVersionPrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TubeVersionPrefetcher(TubeVersionCache& cache, QObject *parent = nullptr);
+    ~TubeVersionPrefetcher();
+
+    // Сколько версий загружать в каждую сторону от текущей
+    void setDepth(int depth);
+    int getDepth() const { return depth; }
+
+    // Предел объёма ещё не использованных предзагруженных версий в кэше
+    void setByteBudget(size_t bytes);
+    size_t getByteBudget() const { return byteBudget; }
+
+    // Вызывается после перехода на версию tubeId (GUI-поток)
+    void prefetchAround(int64_t tubeId);
+
+    // Учитывает обращение к версии при навигации: попадание в предзагрузку или промах
+    void recordNavigation(int64_t tubeId);
+
+    // Кэш сброшен: результаты уже запущенных загрузок станут неактуальны
+    void invalidate();
+
+    int64_t getHitCount() const { return hits; }
+    int64_t getMissCount() const { return misses; }
+    int64_t getWastedCount() const { return wasted; }
+
+private:
+    static const int DEFAULT_DEPTH = 1;
+    static const size_t DEFAULT_BYTE_BUDGET = 32 * 1024 * 1024;
+    static const int PREFETCH_THREADS = 2;
+    static const int CONNECTION_TIMEOUT_MS = 2000;
+
+    void schedule(int64_t startTubeId, bool future, int steps);
+    void runPrefetch(int64_t startTubeId, bool future, int steps, int generationAtStart);
+    void storePrefetched(int64_t tubeId, std::shared_ptr<const TubeVersionCache::Entry> entry,
+                         int generationAtStart);
+    void finishPrefetch(int64_t startTubeId);
+    void forgetEvicted();
+    size_t unusedPrefetchedBytes() const;
+
+    TubeVersionCache& cache;
+    QThreadPool threadPool;
+    std::atomic<int> generation;
+
+    int depth;
+    size_t byteBudget;
+
+    // Учёт ведётся только в GUI-потоке
+    std::set<int64_t> inFlight;
+    // Предзагруженные, но ещё не открытые версии: tube_id -> оценка объёма
+    std::map<int64_t, size_t> prefetchedUnused;
+    int64_t hits;
+    int64_t misses;
+    int64_t wasted;
+};
+
+#endif // TUBEVERSIONPREFETCHER_H